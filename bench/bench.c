@@ -0,0 +1,957 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <bmsparser.h>
+#include <bmsparser/convert.h>
+#include <bmsparser/feed.h>
+#include <bmsparser/scheduler.h>
+#include <bmsparser/writer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allocator.h"
+#include "sort.h"
+#include "generator.h"
+
+typedef void (*Body)(void *context);
+
+typedef struct Input
+{
+    const char *name;
+    char *data;
+    size_t size;
+} Input;
+
+typedef struct Resolve
+{
+    const bms_Chart *chart;
+    double sink;
+} Resolve;
+
+typedef struct Batch
+{
+    const bms_Chart *chart;
+    float *fractions;
+    double *times;
+    float *out;
+    size_t size;
+} Batch;
+
+typedef struct Decode
+{
+    bms_Source *source;
+    bms_Chart *chart;
+} Decode;
+
+typedef struct Reuse
+{
+    const Input *input;
+    bms_Chart *chart;
+} Reuse;
+
+typedef struct Sort
+{
+    const bms_Obj *objs;
+    bms_Obj *work;
+    size_t size;
+} Sort;
+
+typedef struct Write
+{
+    const bms_Chart *chart;
+    char *text;
+    size_t size;
+} Write;
+
+/*
+ * One call to the counting allocator: the block passed in and the block handed back.
+ */
+typedef struct Call
+{
+    void *ptr;
+    void *result;
+} Call;
+
+/*
+ * Allocator counting its calls, logging them while log_capacity is not 0.
+ */
+typedef struct Counter
+{
+    size_t calls;
+    Call *log;
+    size_t log_size;
+    size_t log_capacity;
+} Counter;
+
+typedef struct Convert
+{
+    const char *src;
+    char *dst;
+} Convert;
+
+static double minTime = 0.25;
+static unsigned int threads = 4;
+static const char *filter = NULL;
+static int failures = 0;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(const char *name, const char *input, Body body, void *context, double bytes, double items)
+{
+    size_t iterations = 0;
+    double start, elapsed;
+    if (filter && !strstr(name, filter))
+        return;
+    start = now();
+    do
+    {
+        body(context);
+        iterations++;
+        elapsed = now() - start;
+    } while (elapsed < minTime);
+    printf("{\"benchmark\":\"%s\",\"input\":\"%s\",\"iterations\":%zu,\"seconds\":%.6f,\"ns_per_op\":%.1f",
+           name, input, iterations, elapsed, elapsed * 1e9 / iterations);
+    if (bytes > 0)
+        printf(",\"bytes_per_op\":%.0f,\"mb_per_s\":%.2f", bytes, bytes * iterations / elapsed / 1e6);
+    if (items > 0)
+        printf(",\"items_per_op\":%.0f,\"ns_per_item\":%.2f", items, elapsed * 1e9 / iterations / items);
+    printf("}\n");
+    fflush(stdout);
+}
+
+static bms_Chart *parseInput(const Input *input)
+{
+    FILE *file = fmemopen(input->data, input->size, "rb");
+    bms_Chart *chart = bms_alloc();
+    bms_parse(chart, file);
+    fclose(file);
+    return chart;
+}
+
+static void benchParse(void *context)
+{
+    bms_free(parseInput(context));
+}
+
+static void benchParseReuse(void *context)
+{
+    Reuse *r = context;
+    bms_reset(r->chart);
+    bms_parse_buffer(r->chart, r->input->data, r->input->size, NULL);
+}
+
+static void benchParseThreads(void *context)
+{
+    const Input *input = context;
+    bms_ParseOptions options = {NULL, NULL, threads};
+    bms_Chart *chart = bms_alloc();
+    bms_parse_buffer(chart, input->data, input->size, &options);
+    bms_free(chart);
+}
+
+// Parses in 1 ms slices, as a game would between frames.
+static void benchParseStep(void *context)
+{
+    const Input *input = context;
+    bms_Chart *chart = bms_alloc();
+    bms_Parser *parser = bms_parser_alloc_buffer(chart, input->data, input->size, NULL);
+    while (bms_parser_step(parser, 1000) < 1)
+        ;
+    bms_parser_free(parser);
+    bms_free(chart);
+}
+
+static void benchSourceParse(void *context)
+{
+    Input *input = context;
+    FILE *file = fmemopen(input->data, input->size, "rb");
+    bms_Source *source = bms_source_alloc();
+    bms_source_parse(source, file);
+    bms_source_free(source);
+    fclose(file);
+}
+
+static void benchMaterialize(void *context)
+{
+    const bms_Source *source = context;
+    int *values = malloc(sizeof(int) * (bms_source_randoms(source) + 1));
+    size_t variants = bms_source_variants(source);
+    size_t i;
+    for (i = 0; i < variants && i < 64; i++)
+    {
+        bms_Chart *chart = bms_alloc();
+        bms_source_variant(source, i, values);
+        bms_source_materialize(source, chart, values);
+        bms_free(chart);
+    }
+    free(values);
+}
+
+static unsigned char objLess(void *a, void *b)
+{
+    return ((bms_Obj *)a)->fraction < ((bms_Obj *)b)->fraction;
+}
+
+// Channel lines only, so materializing is mostly decoding slots.
+static void benchChannelDecode(void *context)
+{
+    Decode *d = context;
+    int value = 0;
+    bms_reset(d->chart);
+    bms_source_materialize(d->source, d->chart, &value);
+}
+
+static char *channelLines(const Input *input, size_t *size)
+{
+    char *data = malloc(input->size + 1);
+    const char *line = input->data;
+    const char *end = input->data + input->size;
+    *size = 0;
+    while (line < end)
+    {
+        const char *next = memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+        if (next - line > 6 && line[0] == '#' && line[1] >= '0' && line[1] <= '9' && line[6] == ':')
+        {
+            memcpy(data + *size, line, next - line);
+            *size += next - line;
+        }
+        line = next;
+    }
+    return data;
+}
+
+static void benchSort(void *context)
+{
+    Sort *s = context;
+    memcpy(s->work, s->objs, sizeof(bms_Obj) * s->size);
+    bms_sort(s->work, s->size, sizeof(bms_Obj), objLess, bms_default_allocator());
+}
+
+static void benchResolveFraction(void *context)
+{
+    Resolve *r = context;
+    size_t i;
+    for (i = 0; i < r->chart->objs_size; i++)
+    {
+        r->sink += bms_resolveFraction(r->chart, r->chart->objs[i].fraction);
+    }
+}
+
+static void benchTimeToFraction(void *context)
+{
+    Resolve *r = context;
+    size_t i;
+    for (i = 0; i < r->chart->objs_size; i++)
+    {
+        r->sink += bms_timeToFraction(r->chart, r->chart->objs[i].time);
+    }
+}
+
+static void benchResolveFractions(void *context)
+{
+    Batch *b = context;
+    bms_resolveFractions(b->chart, b->fractions, b->out, b->size);
+}
+
+static void benchTimesToFractions(void *context)
+{
+    Batch *b = context;
+    bms_timesToFractions(b->chart, b->times, b->out, b->size);
+}
+
+static void benchScheduler(void *context)
+{
+    Resolve *r = context;
+    const bms_Obj *const *events;
+    bms_Scheduler *scheduler = bms_scheduler_alloc(r->chart);
+    double end = r->chart->objs_size ? r->chart->objs[r->chart->objs_size - 1].time : 0;
+    double t;
+    int q;
+    for (t = 0; t <= end + 1.0 / 60; t += 1.0 / 60)
+    {
+        for (q = 0; q < bms_QUEUE_COUNT; q++)
+        {
+            r->sink += bms_scheduler_pop(scheduler, q, t, &events);
+        }
+    }
+    bms_scheduler_free(scheduler);
+}
+
+// One key press per note, on its lane, slightly late.
+static void benchNearestNote(void *context)
+{
+    Resolve *r = context;
+    size_t i;
+    for (i = 0; i < r->chart->objs_size; i++)
+    {
+        const bms_Obj *obj = r->chart->objs + i;
+        if (obj->type == bms_OBJTYPE_NOTE)
+            r->sink += bms_nearest_note(r->chart, obj->note.player, obj->note.line, obj->time + 0.01, 0.2);
+    }
+}
+
+static void benchComputeStats(void *context)
+{
+    bms_Chart *chart = context;
+    chart->stats_valid = 0;
+    bms_compute_stats(chart);
+}
+
+/*
+ * Insert a tempo change at 90% of the objects and remove it again, as an editor would.
+ */
+static void benchRetimeTail(void *context)
+{
+    bms_Chart *chart = context;
+    float fraction = chart->objs_size ? chart->objs[chart->objs_size * 9 / 10].fraction : 0;
+    bms_remove_sector(chart, bms_insert_tempo(chart, fraction, 180 / 240.0));
+}
+
+/*
+ * Change the initial tempo, which retimes the whole chart.
+ */
+static void benchRetimeFull(void *context)
+{
+    bms_Chart *chart = context;
+    bms_set_tempo(chart, 0, chart->sectors[0].delta);
+}
+
+static void benchFeed(void *context)
+{
+    Resolve *r = context;
+    bms_Obj events[64];
+    bms_Scheduler *scheduler = bms_scheduler_alloc(r->chart);
+    bms_Feed *feed = bms_feed_alloc(256);
+    double end = r->chart->objs_size ? r->chart->objs[r->chart->objs_size - 1].time : 0;
+    double t;
+    for (t = 0; t <= end + 1.0 / 60; t += 1.0 / 60)
+    {
+        bms_feed_fill(feed, scheduler, 1 << bms_QUEUE_BGM | 1 << bms_QUEUE_KEYSOUND, t + 0.5);
+        r->sink += bms_feed_drain(feed, t, events, 64);
+    }
+    bms_feed_free(feed);
+    bms_scheduler_free(scheduler);
+}
+
+static void benchWrite(void *context)
+{
+    Write *w = context;
+    bms_write_buffer(w->chart, w->text, w->size);
+}
+
+/*
+ * Parse the written text back: objects must land at the same fractions and times,
+ * and writing the result again must give the same text.
+ */
+static const char *roundTrip(const Write *w)
+{
+    const bms_Chart *chart = w->chart;
+    const char *failure = NULL;
+    size_t i;
+    bms_Chart *parsed = bms_alloc();
+    bms_parse_buffer(parsed, w->text, w->size, NULL);
+    if (parsed->objs_size != chart->objs_size)
+        failure = "object count differs";
+    else if (parsed->sectors_size != chart->sectors_size)
+        failure = "sector count differs";
+    else if (parsed->longnotes_size != chart->longnotes_size)
+        failure = "long note count differs";
+    for (i = 0; !failure && i < chart->objs_size; i++)
+    {
+        if (parsed->objs[i].fraction != chart->objs[i].fraction || parsed->objs[i].time != chart->objs[i].time)
+            failure = "object time differs";
+    }
+    if (!failure)
+    {
+        char *text = malloc(w->size + 1);
+        if (bms_write_buffer(parsed, text, w->size) != w->size || memcmp(text, w->text, w->size))
+            failure = "text differs when written again";
+        free(text);
+    }
+    bms_free(parsed);
+    return failure;
+}
+
+/*
+ * Whether every object is back at the time it had before some edits.
+ */
+static int sameTimes(const bms_Chart *chart, const double *times)
+{
+    size_t i;
+    for (i = 0; i < chart->objs_size; i++)
+    {
+        if (chart->objs[i].time != times[i])
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Insert a stop where there is no sector yet, then check that removing either of its sectors removes both
+ * and gives back the same times, and that its start takes no tempo.
+ */
+static const char *editCheck(bms_Chart *chart)
+{
+    const char *failure = NULL;
+    size_t sectors = chart->sectors_size;
+    float fraction = chart->objs_size ? chart->objs[chart->objs_size / 2].fraction : 0.5f;
+    size_t i, end;
+    // Halfway between two sectors from the middle on, or past the last one.
+    for (i = sectors / 2 > 1 ? sectors / 2 : 1; i <= sectors; i++)
+    {
+        float low = chart->sectors[i - 1].fraction;
+        float high = i < sectors ? chart->sectors[i].fraction : low + 1;
+        float middle = low + (high - low) / 2;
+        if (middle != low && middle != high && middle < 1000)
+        {
+            fraction = middle;
+            break;
+        }
+    }
+    double *times = malloc(sizeof(double) * (chart->objs_size + 1));
+    for (i = 0; i < chart->objs_size; i++)
+        times[i] = chart->objs[i].time;
+
+    // With no other sector at the fraction, the stop starts right before it ends.
+    for (i = 0; !failure && i < 2; i++)
+    {
+        end = bms_insert_stop(chart, fraction, 0.25);
+        if (!end || chart->sectors[end - 1].delta != 0)
+            failure = "stop not inserted";
+        else if (bms_set_tempo(chart, end - 1, 1))
+            failure = "tempo set on a stop";
+        else if (!bms_remove_sector(chart, end - i) || chart->sectors_size != sectors)
+            failure = "stop not removed whole";
+        else if (!sameTimes(chart, times))
+            failure = "time differs after removing a stop";
+    }
+    free(times);
+    return failure;
+}
+
+/*
+ * Length from fraction a to fraction b walked measure by measure, as the parser did before it kept a measure table.
+ */
+static float walkFractions(const float *signatures, float a, float b)
+{
+    unsigned char negative = a > b;
+    if (negative)
+    {
+        float temp = a;
+        a = b;
+        b = temp;
+    }
+    int aM = (int)a;
+    int bM = (int)b;
+    float result = (b - bM) * (bM >= 0 ? signatures[bM] : 1) - (a - aM) * (aM >= 0 ? signatures[aM] : 1);
+    int i;
+    for (i = aM; i < bM; i++)
+        result += i >= 0 ? signatures[i] : 1;
+    return negative ? -result : result;
+}
+
+/*
+ * Time every sector and object again with walkFractions: the parsed times must be the same.
+ */
+static const char *timeCheck(const bms_Chart *chart)
+{
+    const char *failure = NULL;
+    double *times = malloc(sizeof(double) * chart->sectors_size);
+    size_t i, s;
+    times[0] = chart->sectors[0].time;
+    for (i = 1; !failure && i < chart->sectors_size; i++)
+    {
+        const bms_Sector *sector = chart->sectors + i;
+        size_t p = i - 1;
+        while (p > 0 && (chart->sectors[p].delta == 0 || chart->sectors[p].fraction == sector->fraction && !chart->sectors[p].inclusive))
+            p--;
+        times[i] = times[p] + (walkFractions(chart->signatures, chart->sectors[p].fraction, sector->fraction) + sector->stop) / chart->sectors[p].delta;
+        if (times[i] != sector->time)
+            failure = "sector time differs";
+    }
+    for (i = 0, s = 0; !failure && i < chart->objs_size; i++)
+    {
+        const bms_Obj *obj = chart->objs + i;
+        while (s + 1 < chart->sectors_size && (chart->sectors[s + 1].fraction < obj->fraction || chart->sectors[s + 1].fraction == obj->fraction && chart->sectors[s + 1].inclusive))
+            s++;
+        const bms_Sector *sector = chart->sectors + s;
+        double time = sector->delta > 0 ? times[s] + walkFractions(chart->signatures, sector->fraction, obj->fraction) / sector->delta : times[s];
+        if (time != obj->time)
+            failure = "object time differs";
+    }
+    free(times);
+    return failure;
+}
+
+static void *countRealloc(void *user, void *ptr, size_t old_size, size_t size)
+{
+    Counter *counter = user;
+    void *result = NULL;
+    (void)old_size;
+    if (size > 0)
+        result = realloc(ptr, size);
+    else
+        free(ptr);
+    counter->calls++;
+    if (counter->log_capacity)
+    {
+        if (counter->log_size == counter->log_capacity)
+        {
+            counter->log_capacity *= 2;
+            counter->log = realloc(counter->log, sizeof(Call) * counter->log_capacity);
+        }
+        counter->log[counter->log_size].ptr = ptr;
+        counter->log[counter->log_size++].result = result;
+    }
+    return result;
+}
+
+/*
+ * Logged calls that led to block, following each reallocation back to the block it grew.
+ */
+static size_t lineage(const Counter *counter, const void *block)
+{
+    size_t calls = 0;
+    size_t i = counter->log_size;
+    while (block && i > 0)
+    {
+        i--;
+        if (counter->log[i].result == block)
+        {
+            calls++;
+            block = counter->log[i].ptr;
+        }
+    }
+    return calls;
+}
+
+/*
+ * Allocations growing an array from capacity to size by doubling, as objs (from 64) and sectors (from 16) grew
+ * before presize.
+ */
+static size_t doublings(size_t size, size_t capacity, size_t initial)
+{
+    size_t calls = 0;
+    while (capacity < size)
+    {
+        capacity = capacity ? capacity * 2 : initial;
+        calls++;
+    }
+    return calls;
+}
+
+/*
+ * Parse into a fresh chart, reporting the allocations of objs and sectors against those doubling would take.
+ * presize must fit both arrays exactly.
+ */
+static void presizeCheck(const Input *input)
+{
+    Counter counter = {0, NULL, 0, 0};
+    bms_Allocator allocator = {countRealloc, &counter};
+    bms_Chart *chart = bms_alloc_with(&allocator);
+    const char *failure = NULL;
+    counter.log_capacity = 64;
+    counter.log = malloc(sizeof(Call) * counter.log_capacity);
+    counter.calls = 0;
+    bms_parse_buffer(chart, input->data, input->size, NULL);
+    size_t presized = lineage(&counter, chart->objs) + lineage(&counter, chart->sectors);
+    size_t doubled = doublings(chart->objs_size, 0, 64) + doublings(chart->sectors_size, 1, 16);
+    if (chart->objs_capacity != chart->objs_size || chart->sectors_capacity != chart->sectors_size)
+        failure = "objs or sectors not sized exactly";
+    printf("{\"benchmark\":\"presize\",\"input\":\"%s\",\"objs\":%zu,\"sectors\":%zu,"
+           "\"allocations\":%zu,\"doubling_allocations\":%zu,\"parse_allocations\":%zu,\"status\":\"%s\"}\n",
+           input->name, chart->objs_size, chart->sectors_size, presized, doubled, counter.calls, failure ? failure : "ok");
+    failures += failure != NULL;
+    counter.log_capacity = 0;
+    free(counter.log);
+    bms_free(chart);
+}
+
+static size_t chartCapacity(const bms_Chart *chart)
+{
+    return chart->objs_capacity + chart->sectors_capacity + chart->longnotes_capacity + chart->lanes_capacity + chart->text_capacity;
+}
+
+/*
+ * Parse again into the reset chart, returning the allocator calls it made.
+ * #RANDOM can select branches needing more room than any parse before: those are counted in grown instead.
+ */
+static size_t reparse(Reuse *reuse, const bms_ParseOptions *options, Counter *counter, size_t *grown)
+{
+    size_t capacity = chartCapacity(reuse->chart);
+    counter->calls = 0;
+    bms_reset(reuse->chart);
+    bms_parse_buffer(reuse->chart, reuse->input->data, reuse->input->size, options);
+    if (chartCapacity(reuse->chart) == capacity)
+        return counter->calls;
+    (*grown)++;
+    return 0;
+}
+
+/*
+ * Allocator calls of parses into a chart reset each time: the first one sizes the buffers kept by the chart,
+ * later ones, serial or threaded, must not call the allocator at all.
+ */
+static void reuseCheck(const Input *input)
+{
+    Counter counter = {0, NULL, 0, 0};
+    bms_Allocator allocator = {countRealloc, &counter};
+    bms_ParseOptions options = {NULL, NULL, threads};
+    Reuse reuse = {input, bms_alloc_with(&allocator)};
+    const char *failure = NULL;
+    size_t first, later = 0, threaded = 0, grown = 0;
+    int i;
+    counter.calls = 0;
+    benchParseReuse(&reuse);
+    first = counter.calls;
+    for (i = 0; i < 3; i++)
+        later += reparse(&reuse, NULL, &counter, &grown);
+    reparse(&reuse, &options, &counter, &grown);
+    for (i = 0; i < 3; i++)
+        threaded += reparse(&reuse, &options, &counter, &grown);
+    if (later || threaded)
+        failure = "allocator called again by a parse into a reset chart";
+    printf("{\"benchmark\":\"reuse_allocations\",\"input\":\"%s\",\"first\":%zu,\"later\":%zu,\"threaded\":%zu,\"grown\":%zu,\"status\":\"%s\"}\n",
+           input->name, first, later, threaded, grown, failure ? failure : "ok");
+    failures += failure != NULL;
+    bms_free(reuse.chart);
+}
+
+static void benchSjis(void *context)
+{
+    Convert *c = context;
+    bms_sjis_to_utf8(c->src, c->dst);
+}
+
+static void printStats(const Input *input)
+{
+    bms_ParseStats stats;
+    bms_ParseOptions options = {.stats = &stats};
+    FILE *file = fmemopen(input->data, input->size, "rb");
+    bms_Chart *chart = bms_alloc();
+    bms_parse_with(chart, file, &options);
+    fclose(file);
+    bms_free(chart);
+    if (filter && !strstr("parse_stats", filter))
+        return;
+    printf("{\"benchmark\":\"parse_stats\",\"input\":\"%s\","
+           "\"read_ns\":%.0f,\"tokenize_ns\":%.0f,\"header_ns\":%.0f,\"channel_ns\":%.0f,"
+           "\"sector_sort_ns\":%.0f,\"sector_ns\":%.0f,\"object_sort_ns\":%.0f,\"object_ns\":%.0f,"
+           "\"bytes\":%zu,\"lines\":%zu,\"control_lines\":%zu,\"header_lines\":%zu,\"channel_lines\":%zu,"
+           "\"ignored_lines\":%zu,\"skipped_statements\":%zu,\"allocations\":%zu,\"peak_memory\":%zu}\n",
+           input->name,
+           stats.read_time * 1e9, stats.tokenize_time * 1e9, stats.header_time * 1e9, stats.channel_time * 1e9,
+           stats.sector_sort_time * 1e9, stats.sector_time * 1e9, stats.object_sort_time * 1e9, stats.object_time * 1e9,
+           stats.bytes, stats.lines, stats.control_lines, stats.header_lines, stats.channel_lines,
+           stats.ignored_lines, stats.skipped_statements, stats.allocations, stats.peak_memory);
+}
+
+static void benchInput(const Input *input)
+{
+    size_t i;
+
+    run("parse", input->name, benchParse, (void *)input, input->size, 0);
+    Reuse reuse = {input, bms_alloc()};
+    run("parse_reuse", input->name, benchParseReuse, &reuse, input->size, 0);
+    bms_free(reuse.chart);
+    run("parse_threads", input->name, benchParseThreads, (void *)input, input->size, 0);
+    run("parse_step", input->name, benchParseStep, (void *)input, input->size, 0);
+    printStats(input);
+    if (!filter || strstr("presize", filter))
+        presizeCheck(input);
+    if (!filter || strstr("reuse_allocations", filter))
+        reuseCheck(input);
+
+    FILE *file = fmemopen(input->data, input->size, "rb");
+    bms_Source *source = bms_source_alloc();
+    bms_source_parse(source, file);
+    fclose(file);
+    run("source_parse", input->name, benchSourceParse, (void *)input, input->size, 0);
+    run("materialize", input->name, benchMaterialize, source, 0, bms_source_variants(source) < 64 ? bms_source_variants(source) : 64);
+    bms_source_free(source);
+
+    size_t channels_size;
+    char *channels = channelLines(input, &channels_size);
+    Decode decode = {bms_source_alloc(), bms_alloc()};
+    bms_source_parse_buffer(decode.source, channels, channels_size);
+    benchChannelDecode(&decode);
+    run("channel_decode", input->name, benchChannelDecode, &decode, 0, decode.chart->objs_size + decode.chart->sectors_size);
+    bms_source_free(decode.source);
+    bms_free(decode.chart);
+    free(channels);
+
+    bms_Chart *chart = parseInput(input);
+
+    Sort s;
+    s.objs = chart->objs;
+    s.size = chart->objs_size;
+    s.work = malloc(sizeof(bms_Obj) * (s.size + 1));
+    for (i = 0; i < s.size; i++)
+    {
+        s.work[i] = chart->objs[(i * 7919) % s.size];
+    }
+    s.objs = s.work;
+    s.work = malloc(sizeof(bms_Obj) * (s.size + 1));
+    run("sort", input->name, benchSort, &s, 0, s.size);
+    free((void *)s.objs);
+    free(s.work);
+
+    if (!filter || strstr("time_check", filter))
+    {
+        const char *failure = timeCheck(chart);
+        printf("{\"benchmark\":\"time_check\",\"input\":\"%s\",\"status\":\"%s\"}\n", input->name, failure ? failure : "ok");
+        failures += failure != NULL;
+    }
+
+    Resolve r = {chart, 0};
+    run("resolveFraction", input->name, benchResolveFraction, &r, 0, chart->objs_size);
+    run("timeToFraction", input->name, benchTimeToFraction, &r, 0, chart->objs_size);
+
+    Batch b = {chart, malloc(sizeof(float) * (chart->objs_size + 1)), malloc(sizeof(double) * (chart->objs_size + 1)),
+               malloc(sizeof(float) * (chart->objs_size + 1)), chart->objs_size};
+    for (i = 0; i < b.size; i++)
+    {
+        b.fractions[i] = chart->objs[i].fraction;
+        b.times[i] = chart->objs[i].time;
+    }
+    run("resolveFractions", input->name, benchResolveFractions, &b, 0, b.size);
+    run("timesToFractions", input->name, benchTimesToFractions, &b, 0, b.size);
+    free(b.fractions);
+    free(b.times);
+    free(b.out);
+    run("scheduler", input->name, benchScheduler, &r, 0, chart->objs_size);
+    run("feed", input->name, benchFeed, &r, 0, chart->objs_size);
+    run("nearest_note", input->name, benchNearestNote, &r, 0, chart->objs_size);
+    run("compute_stats", input->name, benchComputeStats, chart, 0, chart->objs_size);
+    run("retime_tail", input->name, benchRetimeTail, chart, 0, 1);
+    run("retime_full", input->name, benchRetimeFull, chart, 0, 1);
+    if (!filter || strstr("edit_check", filter))
+    {
+        const char *failure = editCheck(chart);
+        printf("{\"benchmark\":\"edit_check\",\"input\":\"%s\",\"status\":\"%s\"}\n", input->name, failure ? failure : "ok");
+        failures += failure != NULL;
+    }
+
+    Write w = {chart, NULL, bms_write_buffer(chart, NULL, 0)};
+    w.text = malloc(w.size + 1);
+    benchWrite(&w);
+    run("write", input->name, benchWrite, &w, w.size, chart->objs_size);
+    if (!filter || strstr("write_roundtrip", filter))
+    {
+        const char *failure = roundTrip(&w);
+        printf("{\"benchmark\":\"write_roundtrip\",\"input\":\"%s\",\"bytes\":%zu,\"status\":\"%s\"}\n",
+               input->name, w.size, failure ? failure : "ok");
+        failures += failure != NULL;
+    }
+    free(w.text);
+
+    bms_free(chart);
+}
+
+/*
+ * Whether two parses of the same input gave the same sectors and objects.
+ */
+static int sameChart(const bms_Chart *a, const bms_Chart *b)
+{
+    size_t i;
+    if (a->objs_size != b->objs_size || a->sectors_size != b->sectors_size)
+        return 0;
+    for (i = 0; i < a->sectors_size; i++)
+    {
+        if (a->sectors[i].fraction != b->sectors[i].fraction || a->sectors[i].time != b->sectors[i].time)
+            return 0;
+    }
+    for (i = 0; i < a->objs_size; i++)
+    {
+        if (a->objs[i].type != b->objs[i].type || a->objs[i].fraction != b->objs[i].fraction || a->objs[i].time != b->objs[i].time)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * A chart of every measure, large enough for parse_threads to split it into chunks.
+ * It has no #RANDOM, so the serial and threaded parses must agree exactly.
+ */
+static void benchSplit(const bench_Spec *spec)
+{
+    bench_Spec large = *spec;
+    Input input;
+    large.measures = 999;
+    large.randoms = 0;
+    input.name = "synthetic_large";
+    input.data = bench_generate(&large, &input.size);
+    run("parse", input.name, benchParse, &input, input.size, 0);
+    run("parse_threads", input.name, benchParseThreads, &input, input.size, 0);
+    if (!filter || strstr("threads_check", filter))
+    {
+        bms_ParseOptions options = {NULL, NULL, threads};
+        bms_Chart *serial = bms_alloc();
+        bms_Chart *threaded = bms_alloc();
+        bms_parse_buffer(serial, input.data, input.size, NULL);
+        bms_parse_buffer(threaded, input.data, input.size, &options);
+        const char *failure = sameChart(serial, threaded) ? NULL : "threaded parse differs";
+        printf("{\"benchmark\":\"threads_check\",\"input\":\"%s\",\"bytes\":%zu,\"threads\":%u,\"status\":\"%s\"}\n",
+               input.name, input.size, threads, failure ? failure : "ok");
+        failures += failure != NULL;
+        bms_free(serial);
+        bms_free(threaded);
+    }
+    free(input.data);
+}
+
+static void benchConvert(size_t length)
+{
+    static const char pattern[] = "\x83\x65\x83\x58\x83\x67 test \x8B\xC8";
+    char name[32];
+    size_t i;
+    Convert c;
+    char *src = malloc(length + 1);
+    for (i = 0; i < length; i++)
+    {
+        src[i] = pattern[i % (sizeof(pattern) - 1)];
+    }
+    src[length] = '\0';
+    c.src = src;
+    c.dst = malloc(3 * length + 1);
+    snprintf(name, sizeof(name), "sjis-%zu", length);
+    run("sjis_to_utf8", name, benchSjis, &c, length, 0);
+    free(c.dst);
+    free(src);
+}
+
+static char *readFile(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    char *data = NULL;
+    size_t capacity = 0;
+    *size = 0;
+    if (!file)
+        return NULL;
+    for (;;)
+    {
+        if (*size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 65536;
+            data = realloc(data, capacity);
+        }
+        size_t n = fread(data + *size, 1, capacity - *size, file);
+        if (n == 0)
+            break;
+        *size += n;
+    }
+    fclose(file);
+    return data;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [options] [file.bms ...]\n"
+            "  --measures N      measures of the synthetic chart (max 999)\n"
+            "  --density N       notes per measure\n"
+            "  --bpm-changes N   channel 08 BPM changes\n"
+            "  --stops N         channel 09 stops\n"
+            "  --randoms N       #RANDOM blocks\n"
+            "  --sjis            Shift-JIS headers\n"
+            "  --seed N          generator seed\n"
+            "  --min-time S      minimum seconds per benchmark\n"
+            "  --filter NAME     only run benchmarks whose name contains NAME\n"
+            "  --threads N       threads of parse_threads (default 4)\n"
+            "  --dump            print the synthetic chart and exit\n"
+            "Results are printed as one JSON object per line.\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    bench_Spec spec;
+    int dump = 0;
+    int files = 0;
+    int i;
+
+    bench_default_spec(&spec);
+    for (i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "--sjis"))
+            spec.sjis = 1;
+        else if (!strcmp(arg, "--dump"))
+            dump = 1;
+        else if (!strncmp(arg, "--", 2) && !value)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else if (!strcmp(arg, "--measures"))
+            spec.measures = atoi(argv[++i]);
+        else if (!strcmp(arg, "--density"))
+            spec.density = atoi(argv[++i]);
+        else if (!strcmp(arg, "--bpm-changes"))
+            spec.bpm_changes = atoi(argv[++i]);
+        else if (!strcmp(arg, "--stops"))
+            spec.stops = atoi(argv[++i]);
+        else if (!strcmp(arg, "--randoms"))
+            spec.randoms = atoi(argv[++i]);
+        else if (!strcmp(arg, "--seed"))
+            spec.seed = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(arg, "--min-time"))
+            minTime = atof(argv[++i]);
+        else if (!strcmp(arg, "--filter"))
+            filter = argv[++i];
+        else if (!strcmp(arg, "--threads"))
+            threads = atoi(argv[++i]);
+        else if (!strncmp(arg, "--", 2))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+            files++;
+    }
+
+    Input input;
+    input.name = "synthetic";
+    input.data = bench_generate(&spec, &input.size);
+    if (dump)
+    {
+        fwrite(input.data, 1, input.size, stdout);
+        free(input.data);
+        return 0;
+    }
+    if (!files)
+    {
+        benchInput(&input);
+        benchSplit(&spec);
+        benchConvert(64);
+        benchConvert(4096);
+    }
+    free(input.data);
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strncmp(argv[i], "--", 2))
+        {
+            if (strcmp(argv[i], "--sjis") && strcmp(argv[i], "--dump"))
+                i++;
+            continue;
+        }
+        input.name = argv[i];
+        input.data = readFile(argv[i], &input.size);
+        if (!input.data)
+        {
+            fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[i]);
+            continue;
+        }
+        benchInput(&input);
+        free(input.data);
+    }
+    return failures != 0;
+}
@@ -0,0 +1,177 @@
+#include "generator.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Buffer
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+static const int lanes[8] = {1, 2, 3, 4, 5, 8, 9, 6};
+
+static void append(Buffer *buffer, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    while (buffer->size + length + 1 > buffer->capacity)
+    {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->size, length + 1, format, args);
+    va_end(args);
+    buffer->size += length;
+}
+
+static unsigned int next(unsigned int *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (*seed >> 8) & 0xffffff;
+}
+
+static void key36(char *dst, int key)
+{
+    static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    dst[0] = digits[key / 36 % 36];
+    dst[1] = digits[key % 36];
+}
+
+static void channel(Buffer *buffer, int measure, int channel, int resolution, const int *keys)
+{
+    int i;
+    char key[2];
+    append(buffer, "#%03d%02d:", measure, channel);
+    for (i = 0; i < resolution; i++)
+    {
+        key36(key, keys[i]);
+        append(buffer, "%c%c", key[0], key[1]);
+    }
+    append(buffer, "\n");
+}
+
+static void notes(Buffer *buffer, const bench_Spec *spec, unsigned int *seed, int measure, int offset)
+{
+    int resolution = spec->density > 64 ? 48 : 16;
+    int *keys = malloc(sizeof(int) * resolution);
+    int lane, i;
+    for (lane = 0; lane < 8; lane++)
+    {
+        int count = spec->density / 8 + (lane < spec->density % 8);
+        if (count == 0)
+            continue;
+        memset(keys, 0, sizeof(int) * resolution);
+        for (i = 0; i < count; i++)
+        {
+            keys[next(seed) % resolution] = 1 + next(seed) % 1000;
+        }
+        channel(buffer, measure, 10 + offset + lanes[lane], resolution, keys);
+    }
+    free(keys);
+}
+
+void bench_default_spec(bench_Spec *spec)
+{
+    spec->measures = 100;
+    spec->density = 16;
+    spec->bpm_changes = 8;
+    spec->stops = 4;
+    spec->randoms = 2;
+    spec->sjis = 0;
+    spec->seed = 1;
+}
+
+char *bench_generate(const bench_Spec *spec, size_t *size)
+{
+    Buffer buffer = {NULL, 0, 0};
+    unsigned int seed = spec->seed;
+    int measures = spec->measures < 1 ? 1 : spec->measures > 999 ? 999 : spec->measures;
+    int bpm_keys = spec->bpm_changes < 1295 ? spec->bpm_changes : 1295;
+    int stop_keys = spec->stops < 1295 ? spec->stops : 1295;
+    int keys[4] = {0};
+    char key[2];
+    int i, measure;
+
+    append(&buffer, "#PLAYER 1\n");
+    if (spec->sjis)
+    {
+        append(&buffer, "#GENRE \x83\x65\x83\x4E\x83\x6D\n");
+        append(&buffer, "#TITLE \x83\x65\x83\x58\x83\x67\x8B\xC8 [\x83\x41\x83\x69\x83\x55\x81\x5B]\n");
+        append(&buffer, "#ARTIST \x8D\xEC\x8B\xC8\x8E\xD2\n");
+    }
+    else
+    {
+        append(&buffer, "#GENRE Techno\n");
+        append(&buffer, "#TITLE Synthetic [Another]\n");
+        append(&buffer, "#ARTIST Generator\n");
+    }
+    append(&buffer, "#BPM 150\n#PLAYLEVEL 12\n#DIFFICULTY 4\n#RANK 2\n#TOTAL 300\n#STAGEFILE stage.png\n");
+    for (i = 1; i <= 1000; i++)
+    {
+        key36(key, i);
+        append(&buffer, "#WAV%c%c key%04d.wav\n", key[0], key[1], i);
+    }
+    append(&buffer, "#BMP01 bga.mpg\n");
+    for (i = 1; i <= bpm_keys; i++)
+    {
+        key36(key, i);
+        append(&buffer, "#BPM%c%c %d\n", key[0], key[1], 100 + next(&seed) % 200);
+    }
+    for (i = 1; i <= stop_keys; i++)
+    {
+        key36(key, i);
+        append(&buffer, "#STOP%c%c %d\n", key[0], key[1], 12 + next(&seed) % 180);
+    }
+    append(&buffer, "\n");
+
+    for (measure = 0; measure < measures; measure++)
+    {
+        keys[0] = 1 + next(&seed) % 1000;
+        keys[1] = 0;
+        keys[2] = 0;
+        keys[3] = 0;
+        channel(&buffer, measure, 1, 4, keys);
+        if (measure == 0)
+        {
+            keys[0] = 1;
+            channel(&buffer, measure, 4, 1, keys);
+        }
+        if (measure % 16 == 15)
+        {
+            append(&buffer, "#%03d02:0.75\n", measure);
+        }
+        notes(&buffer, spec, &seed, measure, 0);
+    }
+    for (i = 0; i < spec->bpm_changes; i++)
+    {
+        keys[0] = 0;
+        keys[1] = 0;
+        keys[next(&seed) % 2] = 1 + i % bpm_keys;
+        channel(&buffer, (int)((long)i * measures / spec->bpm_changes), 8, 2, keys);
+    }
+    for (i = 0; i < spec->stops; i++)
+    {
+        keys[0] = 0;
+        keys[1] = 0;
+        keys[next(&seed) % 2] = 1 + i % stop_keys;
+        channel(&buffer, (int)((long)i * measures / spec->stops), 9, 2, keys);
+    }
+    for (i = 0; i < spec->randoms; i++)
+    {
+        measure = (int)((long)i * measures / spec->randoms);
+        append(&buffer, "\n#RANDOM 2\n#IF 1\n");
+        notes(&buffer, spec, &seed, measure, 10);
+        append(&buffer, "#ENDIF\n#IF 2\n");
+        notes(&buffer, spec, &seed, measure, 10);
+        append(&buffer, "#ENDIF\n");
+    }
+
+    *size = buffer.size;
+    return buffer.data;
+}
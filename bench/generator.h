@@ -0,0 +1,61 @@
+#ifndef __BMSPARSER_BENCH_GENERATOR_H__
+#define __BMSPARSER_BENCH_GENERATOR_H__
+
+#include <stddef.h>
+
+/**
+ * Shape of a synthetic chart.
+ */
+typedef struct bench_Spec
+{
+    /**
+     * Number of measures.
+     */
+    int measures;
+
+    /**
+     * Notes per measure, spread over the 7+1 lanes of player 1.
+     */
+    int density;
+
+    /**
+     * Number of channel 08 BPM changes.
+     */
+    int bpm_changes;
+
+    /**
+     * Number of channel 09 stops.
+     */
+    int stops;
+
+    /**
+     * Number of `#RANDOM 2` blocks, each holding one measure per branch.
+     */
+    int randoms;
+
+    /**
+     * Whether headers are written in Shift-JIS.
+     */
+    int sjis;
+
+    /**
+     * Seed of the generator.
+     */
+    unsigned int seed;
+} bench_Spec;
+
+/**
+ * Default shape: a 3-minute 7-key chart.
+ * @param spec Spec to fill
+ */
+void bench_default_spec(bench_Spec *spec);
+
+/**
+ * Generate BMS contents.
+ * @param spec Shape of the chart
+ * @param size Size of the contents
+ * @return Allocated contents, free with `free`
+ */
+char *bench_generate(const bench_Spec *spec, size_t *size);
+
+#endif
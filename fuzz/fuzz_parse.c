@@ -0,0 +1,350 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <bmsparser.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * libFuzzer entry point, also usable with AFL through the standalone main.
+ *
+ * Every input is parsed twice:
+ * - through bms_source_parse (FILE) and bms_source_parse_buffer (memory),
+ *   whose materialized charts must be identical, also when materialized into a reset chart,
+ * - through bms_parse_buffer with statistics, which must stay within a time
+ *   and memory budget proportional to the input size.
+ *
+ * The time budget defaults to BMS_FUZZ_TIME_FACTOR (8) times the cost of a baseline parse, measured at startup.
+ * Budgets can be tuned with environment variables:
+ *   BMS_FUZZ_TIME_FACTOR, BMS_FUZZ_BASE_NS, BMS_FUZZ_NS_PER_BYTE, BMS_FUZZ_BASE_BYTES, BMS_FUZZ_BYTES_PER_BYTE
+ */
+
+typedef struct Budget
+{
+    double base_ns;
+    double ns_per_byte;
+    double base_bytes;
+    double bytes_per_byte;
+} Budget;
+
+typedef struct Result
+{
+    double ns;
+    size_t peak_memory;
+    size_t objs;
+    size_t sectors;
+    const char *failure;
+} Result;
+
+static Budget budget;
+static int initialized = 0;
+static int report = 0;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double env(const char *name, double fallback)
+{
+    const char *value = getenv(name);
+    return value ? atof(value) : fallback;
+}
+
+/*
+ * A plain chart of about 80 KB: notes on every key, BGM, long notes, BPM changes and stops.
+ */
+static char *baseline(size_t *size, size_t *header)
+{
+    static const int channels[] = {1, 3, 8, 9, 11, 12, 13, 14, 15, 16, 18, 19, 21, 22, 23, 24, 25, 51, 52};
+    size_t capacity = 1 << 17;
+    char *data = malloc(capacity);
+    int length = sprintf(data, "#BPM 150\n#BPM01 180\n#STOP01 48\n#LNTYPE 1\n");
+    int measure;
+    size_t c;
+    *header = length;
+    for (measure = 0; measure < 200; measure++)
+    {
+        for (c = 0; c < sizeof(channels) / sizeof(*channels); c++)
+        {
+            int channel = channels[c];
+            const char *pattern = channel == 3 ? "00780096" : channel == 8 || channel == 9 ? "0001" : channel > 50 ? "0101" : "0102030400050607";
+            length += sprintf(data + length, "#%03d%02d:%s\n", measure, channel, pattern);
+        }
+    }
+    *size = length;
+    return data;
+}
+
+static double fastestParse(const char *data, size_t size)
+{
+    double fastest = 0;
+    int i;
+    for (i = 0; i < 5; i++)
+    {
+        bms_Chart *chart = bms_alloc();
+        double start = now();
+        bms_parse_buffer(chart, data, size, NULL);
+        double ns = now() - start;
+        bms_free(chart);
+        if (!i || ns < fastest)
+            fastest = ns;
+    }
+    return fastest;
+}
+
+/*
+ * The default time budget is a multiple of the parse of the baseline chart, for the cost per byte,
+ * and of its header alone, for the fixed cost, so it is as tight under a sanitizer as in a release build.
+ */
+static void initialize()
+{
+    if (initialized)
+        return;
+    size_t size;
+    size_t header;
+    char *data = baseline(&size, &header);
+    double fixed = fastestParse(data, header);
+    double perByte = fastestParse(data, size) / size;
+    free(data);
+
+    double factor = env("BMS_FUZZ_TIME_FACTOR", 8);
+    budget.base_ns = env("BMS_FUZZ_BASE_NS", factor * fixed);
+    budget.ns_per_byte = env("BMS_FUZZ_NS_PER_BYTE", factor * perByte);
+    budget.base_bytes = env("BMS_FUZZ_BASE_BYTES", 1 << 20);
+    budget.bytes_per_byte = env("BMS_FUZZ_BYTES_PER_BYTE", 256);
+    initialized = 1;
+}
+
+static int sameText(const char *a, const char *b)
+{
+    return a == b || (a && b && !strcmp(a, b));
+}
+
+static int sameObj(const bms_Obj *a, const bms_Obj *b)
+{
+    if (a->type != b->type || memcmp(&a->fraction, &b->fraction, sizeof(float)) || memcmp(&a->position, &b->position, sizeof(float)) ||
+        memcmp(&a->time, &b->time, sizeof(double)))
+        return 0;
+    switch (a->type)
+    {
+    case bms_OBJTYPE_BGM:
+        return a->bgm.key == b->bgm.key;
+    case bms_OBJTYPE_BMP:
+        return a->bmp.key == b->bmp.key && a->bmp.layer == b->bmp.layer;
+    case bms_OBJTYPE_NOTE:
+        return a->note.player == b->note.player && a->note.line == b->note.line && a->note.key == b->note.key && a->note.end == b->note.end && a->note.pair == b->note.pair;
+    default:
+        return a->misc.player == b->misc.player && a->misc.line == b->misc.line && a->misc.key == b->misc.key;
+    }
+}
+
+static const char *compare(const bms_Chart *a, const bms_Chart *b)
+{
+    size_t i;
+    if (!sameText(a->genre, b->genre) || !sameText(a->title, b->title) || !sameText(a->subtitle, b->subtitle) ||
+        !sameText(a->artist, b->artist) || !sameText(a->subartist, b->subartist) ||
+        !sameText(a->stagefile, b->stagefile) || !sameText(a->banner, b->banner))
+        return "header text differs";
+    if (a->playlevel != b->playlevel || a->difficulty != b->difficulty || a->rank != b->rank || memcmp(&a->total, &b->total, sizeof(float)))
+        return "header value differs";
+    for (i = 0; i < 1296; i++)
+    {
+        if (!sameText(a->wavs[i], b->wavs[i]) || !sameText(a->bmps[i], b->bmps[i]))
+            return "definition differs";
+    }
+    if (memcmp(a->signatures, b->signatures, sizeof(float) * 1000))
+        return "signature differs";
+    if (a->objs_size != b->objs_size)
+        return "object count differs";
+    for (i = 0; i < a->objs_size; i++)
+    {
+        if (!sameObj(a->objs + i, b->objs + i))
+            return "object differs";
+    }
+    if (a->sectors_size != b->sectors_size)
+        return "sector count differs";
+    for (i = 0; i < a->sectors_size; i++)
+    {
+        const bms_Sector *s = a->sectors + i;
+        const bms_Sector *t = b->sectors + i;
+        if (memcmp(&s->fraction, &t->fraction, sizeof(float)) || memcmp(&s->position, &t->position, sizeof(float)) ||
+            memcmp(&s->time, &t->time, sizeof(double)) ||
+            memcmp(&s->delta, &t->delta, sizeof(double)) || memcmp(&s->stop, &t->stop, sizeof(double)) || s->inclusive != t->inclusive)
+            return "sector differs";
+    }
+    if (a->longnotes_size != b->longnotes_size)
+        return "long note count differs";
+    for (i = 0; i < a->longnotes_size; i++)
+    {
+        if (a->longnotes[i].start != b->longnotes[i].start || a->longnotes[i].end != b->longnotes[i].end)
+            return "long note differs";
+    }
+    if (memcmp(a->lane_offsets, b->lane_offsets, sizeof(a->lane_offsets)))
+        return "lane size differs";
+    for (i = 0; i < a->lane_offsets[3 * 36]; i++)
+    {
+        if (a->lanes[i].obj != b->lanes[i].obj)
+            return "lane note differs";
+    }
+    return NULL;
+}
+
+static const char *differential(const char *data, size_t size)
+{
+    const char *failure = NULL;
+    size_t i;
+    FILE *file;
+    if (size == 0 || !(file = fmemopen((void *)data, size, "rb")))
+        return NULL;
+
+    bms_Source *fromFile = bms_source_alloc();
+    bms_Source *fromBuffer = bms_source_alloc();
+    bms_source_parse(fromFile, file);
+    bms_source_parse_buffer(fromBuffer, data, size);
+    fclose(file);
+
+    size_t randoms = bms_source_randoms(fromFile);
+    if (randoms != bms_source_randoms(fromBuffer))
+        failure = "random count differs";
+    for (i = 0; !failure && i < randoms; i++)
+    {
+        if (bms_source_range(fromFile, i) != bms_source_range(fromBuffer, i))
+            failure = "random range differs";
+    }
+    if (!failure)
+    {
+        int *values = malloc(sizeof(int) * (randoms + 1));
+        size_t variants = bms_source_variants(fromFile);
+        bms_Chart *reused = bms_alloc();
+        for (i = 0; !failure && i < variants && i < 4; i++)
+        {
+            bms_Chart *a = bms_alloc();
+            bms_Chart *b = bms_alloc();
+            bms_source_variant(fromFile, i, values);
+            bms_source_materialize(fromFile, a, values);
+            bms_source_materialize(fromBuffer, b, values);
+            failure = compare(a, b);
+            bms_reset(reused);
+            bms_source_materialize(fromBuffer, reused, values);
+            if (!failure && compare(a, reused))
+                failure = "reused chart differs";
+            bms_free(a);
+            bms_free(b);
+        }
+        bms_free(reused);
+        free(values);
+    }
+
+    bms_source_free(fromFile);
+    bms_source_free(fromBuffer);
+    return failure;
+}
+
+static Result check(const char *data, size_t size)
+{
+    Result result;
+    bms_ParseStats stats;
+    bms_ParseOptions options = {.stats = &stats};
+
+    initialize();
+    result.failure = differential(data, size);
+
+    bms_Chart *chart = bms_alloc();
+    double start = now();
+    bms_parse_buffer(chart, data, size, &options);
+    result.ns = now() - start;
+    result.peak_memory = stats.peak_memory;
+    result.objs = chart->objs_size;
+    result.sectors = chart->sectors_size;
+    bms_free(chart);
+
+    if (!result.failure && result.ns > budget.base_ns + budget.ns_per_byte * size)
+        result.failure = "time budget exceeded";
+    if (!result.failure && result.peak_memory > budget.base_bytes + budget.bytes_per_byte * size)
+        result.failure = "memory budget exceeded";
+    if (result.failure && !report)
+    {
+        fprintf(stderr, "bmsparser_fuzz: %s (%zu bytes, %.0f ns, %zu bytes peak, %zu objects, %zu sectors)\n",
+                result.failure, size, result.ns, result.peak_memory, result.objs, result.sectors);
+        abort();
+    }
+    return result;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    check((const char *)data, size);
+    return 0;
+}
+
+#ifdef BMSPARSER_FUZZ_STANDALONE
+
+static char *readAll(FILE *file, size_t *size)
+{
+    char *data = NULL;
+    size_t capacity = 0;
+    *size = 0;
+    for (;;)
+    {
+        if (*size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 65536;
+            data = realloc(data, capacity);
+        }
+        size_t n = fread(data + *size, 1, capacity - *size, file);
+        if (n == 0)
+            break;
+        *size += n;
+    }
+    return data;
+}
+
+static int run(const char *name, FILE *file)
+{
+    size_t size;
+    char *data = readAll(file, &size);
+    Result result = check(data, size);
+    free(data);
+    if (report)
+    {
+        printf("{\"input\":\"%s\",\"bytes\":%zu,\"ns\":%.0f,\"budget_ns\":%.0f,\"ns_per_byte\":%.1f,\"peak_memory\":%zu,\"objects\":%zu,\"sectors\":%zu,\"status\":\"%s\"}\n",
+               name, size, result.ns, budget.base_ns + budget.ns_per_byte * size, size ? result.ns / size : 0, result.peak_memory, result.objs, result.sectors,
+               result.failure ? result.failure : "ok");
+    }
+    return result.failure != NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int failures = 0;
+    int files = 0;
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--report"))
+        {
+            report = 1;
+            continue;
+        }
+        FILE *file = fopen(argv[i], "rb");
+        if (!file)
+        {
+            fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[i]);
+            failures++;
+            continue;
+        }
+        failures += run(argv[i], file);
+        fclose(file);
+        files++;
+    }
+    if (!files && !failures)
+        failures += run("<stdin>", stdin);
+    return failures != 0;
+}
+
+#endif
@@ -4,6 +4,22 @@
 #include <stddef.h>
 #include <stdio.h>
 
+/*
+ * Marks the public API, the only symbols the shared library exports.
+ * BMSPARSER_SHARED is defined when linking to the shared library, and BMSPARSER_EXPORTS when building it.
+ */
+#if defined(_WIN32) && defined(BMSPARSER_SHARED)
+#ifdef BMSPARSER_EXPORTS
+#define BMS_API __declspec(dllexport)
+#else
+#define BMS_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define BMS_API __attribute__((visibility("default")))
+#else
+#define BMS_API
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -60,6 +76,11 @@ extern "C"
          */
         float fraction;
 
+        /**
+         * Position in measure (Resolved), as bms_resolveFraction gives.
+         */
+        float position;
+
         /**
          * Time when it will be executed in seconds.
          */
@@ -121,6 +142,12 @@ extern "C"
                  * Whether it is the end of a long note.
                  */
                 int end;
+
+                /**
+                 * Index of the other end of the long note in `objs`.
+                 * -1 if it is not part of a long note.
+                 */
+                int pair;
             } note;
 
             /**
@@ -157,6 +184,11 @@ extern "C"
          */
         float fraction;
 
+        /**
+         * Position in measure (Resolved), as bms_resolveFraction gives.
+         */
+        float position;
+
         /**
          * Time when it will be started in seconds.
          */
@@ -168,12 +200,55 @@ extern "C"
          */
         double delta;
 
+        /**
+         * Length of the stop in measures for a non-inclusive sector, as `#STOPxx` / 192.
+         * Zero for inclusive sectors.
+         */
+        double stop;
+
         /**
          * Whether it is inclusive or not when searching.
          */
         unsigned char inclusive;
     } bms_Sector;
 
+    /**
+     * Long Note Structure.
+     */
+    typedef struct bms_LongNote
+    {
+        /**
+         * Index of the starting note in `objs`.
+         */
+        size_t start;
+
+        /**
+         * Index of the ending note in `objs`.
+         */
+        size_t end;
+
+        /**
+         * Hold duration in seconds.
+         */
+        double duration;
+    } bms_LongNote;
+
+    /**
+     * Note of a lane, for judgement lookups.
+     */
+    typedef struct bms_LaneNote
+    {
+        /**
+         * Time of the note in seconds.
+         */
+        double time;
+
+        /**
+         * Index of the note in `objs`.
+         */
+        size_t obj;
+    } bms_LaneNote;
+
     /**
      * Difficulty
      */
@@ -231,6 +306,88 @@ extern "C"
         bms_RANK_EASY,
     } bms_Rank;
 
+    /**
+     * Allocation function.
+     * Allocates when ptr is NULL, frees when size is 0, reallocates otherwise.
+     * @param user User data of the allocator
+     * @param ptr Block to reallocate or free, or NULL
+     * @param old_size Size of the block, 0 if ptr is NULL
+     * @param size New size of the block
+     * @return Allocated block, NULL when freeing
+     */
+    typedef void *(*bms_Realloc)(void *user, void *ptr, size_t old_size, size_t size);
+
+    /**
+     * Allocator Structure.
+     */
+    typedef struct bms_Allocator
+    {
+        /**
+         * Allocation function.
+         */
+        bms_Realloc realloc;
+
+        /**
+         * User data passed to the allocation function.
+         */
+        void *user;
+    } bms_Allocator;
+
+    /**
+     * Chart Statistics Structure.
+     * Filled by bms_compute_stats.
+     */
+    typedef struct bms_ChartStats
+    {
+        /**
+         * Playable notes.
+         * A long note counts once.
+         */
+        size_t notes;
+
+        /**
+         * Long notes.
+         */
+        size_t longnotes;
+
+        /**
+         * Playable notes on the scratch lane (line 6).
+         */
+        size_t scratches;
+
+        /**
+         * Time of the last playable note in seconds.
+         * Notes at a time that is not finite, after a zero tempo, are left out of the length, peak and density.
+         */
+        double length;
+
+        /**
+         * Most playable notes within one second.
+         */
+        size_t peak_nps;
+
+        /**
+         * Time of the first note of that second.
+         */
+        double peak_time;
+
+        /**
+         * Playable notes per second of the chart.
+         * `density[i]` counts notes with i <= time < i + 1.
+         */
+        size_t *density;
+
+        /**
+         * Size of the density
+         */
+        size_t density_size;
+
+        /**
+         * Allocated size of the density
+         */
+        size_t density_capacity;
+    } bms_ChartStats;
+
     /**
      * Chart Structure
      */
@@ -322,6 +479,12 @@ extern "C"
          */
         float *signatures;
 
+        /**
+         * Resolved position of the start of every measure, and of the end of the last one.
+         * Computed from the signatures when parsing, 1001 entries.
+         */
+        float *measures;
+
         /**
          * Objects
          */
@@ -332,6 +495,11 @@ extern "C"
          */
         size_t objs_size;
 
+        /**
+         * Allocated size of the objects
+         */
+        size_t objs_capacity;
+
         /**
          * Sectors
          * Parsed from Channel 03, 08, 09.
@@ -342,26 +510,423 @@ extern "C"
          * Size of the sectors
          */
         size_t sectors_size;
+
+        /**
+         * Allocated size of the sectors
+         */
+        size_t sectors_capacity;
+
+        /**
+         * Long notes, ordered by end.
+         * Paired after objects are sorted.
+         */
+        bms_LongNote *longnotes;
+
+        /**
+         * Size of the long notes
+         */
+        size_t longnotes_size;
+
+        /**
+         * Allocated size of the long notes
+         */
+        size_t longnotes_capacity;
+
+        /**
+         * Playable notes grouped by lane, each lane in time order.
+         * The end of a paired long note is left out.
+         * Lane `player * 36 + line` spans from `lane_offsets[lane]` to `lane_offsets[lane + 1]`.
+         */
+        bms_LaneNote *lanes;
+
+        /**
+         * Allocated size of the lanes
+         */
+        size_t lanes_capacity;
+
+        /**
+         * Start of every lane in `lanes`, and their total size at the end.
+         */
+        size_t lane_offsets[3 * 36 + 1];
+
+        /**
+         * Storage of every string of the chart.
+         * Header and definition strings point into it.
+         */
+        char *text;
+
+        /**
+         * Used size of the text storage
+         */
+        size_t text_size;
+
+        /**
+         * Allocated size of the text storage
+         */
+        size_t text_capacity;
+
+        /**
+         * Allocator of the chart buffers.
+         */
+        bms_Allocator allocator;
+
+        /**
+         * Statistics cached by bms_compute_stats.
+         */
+        bms_ChartStats stats;
+
+        /**
+         * Whether `stats` is up to date.
+         * Cleared when the chart is reset or parsed into.
+         */
+        int stats_valid;
+
+        /**
+         * Parser kept for the next parse into the chart, with its buffers and compiled patterns.
+         * Set by the first parse using the chart's allocator, freed with the chart.
+         */
+        struct bms_Parser *parser;
     } bms_Chart;
 
+    /**
+     * Parse Statistics Structure.
+     * Times are in seconds.
+     */
+    typedef struct bms_ParseStats
+    {
+        /**
+         * Time spent reading lines.
+         */
+        double read_time;
+
+        /**
+         * Time spent matching lines into statements.
+         */
+        double tokenize_time;
+
+        /**
+         * Time spent applying headers and control flow.
+         */
+        double header_time;
+
+        /**
+         * Time spent decoding channel lines into objects and sectors.
+         */
+        double channel_time;
+
+        /**
+         * Time spent sorting sectors.
+         */
+        double sector_sort_time;
+
+        /**
+         * Time spent computing sector times.
+         */
+        double sector_time;
+
+        /**
+         * Time spent sorting objects.
+         */
+        double object_sort_time;
+
+        /**
+         * Time spent computing object times.
+         */
+        double object_time;
+
+        /**
+         * Bytes read from the file.
+         */
+        size_t bytes;
+
+        /**
+         * Lines read from the file.
+         */
+        size_t lines;
+
+        /**
+         * `#RANDOM`, `#IF`, `#SWITCH`, etc.
+         */
+        size_t control_lines;
+
+        /**
+         * `#TITLE`, `#WAVxx`, `#BPMxx`, etc.
+         */
+        size_t header_lines;
+
+        /**
+         * `#xxxyy:` lines, including signatures.
+         */
+        size_t channel_lines;
+
+        /**
+         * Empty, comment or unknown lines.
+         */
+        size_t ignored_lines;
+
+        /**
+         * Statements skipped by unselected branches.
+         */
+        size_t skipped_statements;
+
+        /**
+         * Allocations and reallocations performed while parsing.
+         */
+        size_t allocations;
+
+        /**
+         * Highest number of bytes held by the parser at once, counting the buffers it kept from earlier parses.
+         */
+        size_t peak_memory;
+    } bms_ParseStats;
+
+    /**
+     * Parse Options Structure.
+     */
+    typedef struct bms_ParseOptions
+    {
+        /**
+         * Statistics to fill, or NULL.
+         */
+        bms_ParseStats *stats;
+
+        /**
+         * Allocator of the temporary buffers of the parse, or NULL to use the chart's one.
+         * Chart buffers always use the chart's allocator.
+         * Temporary buffers are only kept by the chart for the next parse when they use its allocator.
+         */
+        const bms_Allocator *allocator;
+
+        /**
+         * Number of threads tokenizing a buffer, 0 or 1 to tokenize on the calling thread.
+         * Only large buffers are split, at line boundaries; files are always read on the calling thread.
+         * With more than one thread, the allocator is called from every thread,
+         * bms_parser_step tokenizes the whole buffer in its first step,
+         * and statistics add up the reading and tokenizing time of every thread.
+         */
+        unsigned int threads;
+    } bms_ParseOptions;
+
+    /**
+     * Set the default allocator.
+     * Charts, sources and feeds allocated afterwards use it.
+     * Not thread-safe, set it before any other call.
+     * @param allocator Allocator to copy, or NULL for malloc, realloc and free
+     */
+    BMS_API void bms_set_allocator(const bms_Allocator *allocator);
+
     /**
      * Allocate Chart Structure.
      * @return Allocated chart
      */
-    bms_Chart *bms_alloc();
+    BMS_API bms_Chart *bms_alloc();
 
     /**
-     * Free Chart Structure.
+     * Allocate Chart Structure with an allocator.
+     * The chart and every buffer it owns use it.
+     * @param allocator Allocator to copy, or NULL for the default
+     * @return Allocated chart
+     */
+    BMS_API bms_Chart *bms_alloc_with(const bms_Allocator *allocator);
+
+    /**
+     * Free Chart Structure, and the parser it keeps.
      * @param chart Chart to free
      */
-    void bms_free(bms_Chart *chart);
+    BMS_API void bms_free(bms_Chart *chart);
+
+    /**
+     * Clear Chart Structure as if it was just allocated.
+     * Buffers are kept, and so is the parser of the last parse,
+     * so parsing into it again does not allocate unless it needs more room.
+     * @param chart Chart to clear
+     */
+    BMS_API void bms_reset(bms_Chart *chart);
+
+    /**
+     * Get the playable notes of a lane.
+     * A player can keep a cursor into them, past the notes already judged.
+     * @param chart Parsed chart
+     * @param player Player of the lane
+     * @param line Line of the lane
+     * @param size Set to the number of notes
+     * @return Notes in time order
+     */
+    BMS_API const bms_LaneNote *bms_lane_notes(const bms_Chart *chart, int player, int line, size_t *size);
+
+    /**
+     * Find the note of a lane nearest to the given time.
+     * Takes time logarithmic in the number of notes of the lane.
+     * @param chart Parsed chart
+     * @param player Player of the lane
+     * @param line Line of the lane
+     * @param time Time in seconds, e.g. of a key press
+     * @param window Largest distance to the note in seconds
+     * @return Index of the note in `objs`, or -1 if there is none within the window
+     */
+    BMS_API long bms_nearest_note(const bms_Chart *chart, int player, int line, double time, double window);
+
+    /**
+     * Compute statistics of a parsed chart.
+     * They are computed in one pass over the objects and cached on the chart.
+     * @param chart Parsed chart
+     * @return Statistics, valid until the chart is reset, parsed into or freed
+     */
+    BMS_API const bms_ChartStats *bms_compute_stats(bms_Chart *chart);
 
     /**
      * Parse BMS contents from file.
+     * Reads from the current position to the end; the file does not need to be seekable.
+     * @param chart Chart to fill with BMS contents
+     * @param file File to get BMS contents from
+     */
+    BMS_API void bms_parse(bms_Chart *chart, FILE *file);
+
+    /**
+     * Parse BMS contents from file with options.
+     * @param chart Chart to fill with BMS contents
+     * @param file File to get BMS contents from
+     * @param options Options, or NULL for defaults
+     */
+    BMS_API void bms_parse_with(bms_Chart *chart, FILE *file, const bms_ParseOptions *options);
+
+    /**
+     * Parse BMS contents from memory.
+     * @param chart Chart to fill with BMS contents
+     * @param data BMS contents
+     * @param size Size of the contents in bytes
+     * @param options Options, or NULL for defaults
+     */
+    BMS_API void bms_parse_buffer(bms_Chart *chart, const char *data, size_t size, const bms_ParseOptions *options);
+
+    /**
+     * Incremental parser.
+     * Parses a chart in steps of bounded time, e.g. one per frame.
+     */
+    typedef struct bms_Parser bms_Parser;
+
+    /**
+     * Allocate Parser Structure reading from file.
+     * The file must stay open until the parser is freed.
+     * If it is not seekable, progress stays 0 until reading is done.
+     * @param chart Chart to fill with BMS contents
+     * @param file File to get BMS contents from
+     * @param options Options, or NULL for defaults
+     * @return Allocated parser
+     */
+    BMS_API bms_Parser *bms_parser_alloc(bms_Chart *chart, FILE *file, const bms_ParseOptions *options);
+
+    /**
+     * Allocate Parser Structure reading from memory.
+     * The contents must stay valid until the parser is freed.
      * @param chart Chart to fill with BMS contents
+     * @param data BMS contents
+     * @param size Size of the contents in bytes
+     * @param options Options, or NULL for defaults
+     * @return Allocated parser
+     */
+    BMS_API bms_Parser *bms_parser_alloc_buffer(bms_Chart *chart, const char *data, size_t size, const bms_ParseOptions *options);
+
+    /**
+     * Parse for about the given time.
+     * The chart is complete once it returns 1.
+     * @param parser Parser
+     * @param budget_us Time budget in microseconds
+     * @return Progress, from 0 to 1
+     */
+    BMS_API double bms_parser_step(bms_Parser *parser, unsigned long budget_us);
+
+    /**
+     * Free Parser Structure.
+     * Freeing it before completion leaves the chart partially filled.
+     * A parser using the chart's allocator is kept by the chart for its next parse instead,
+     * so it must be freed before the chart.
+     * @param parser Parser to free
+     */
+    BMS_API void bms_parser_free(bms_Parser *parser);
+
+    /**
+     * Accumulate statistics of a parse, for scans over many files.
+     * Times and counts are added, peak memory is the maximum.
+     * @param total Statistics to accumulate into
+     * @param stats Statistics of a parse
+     */
+    BMS_API void bms_stats_add(bms_ParseStats *total, const bms_ParseStats *stats);
+
+    /**
+     * Tokenized BMS contents.
+     * Conditional blocks (`#IF`, `#SWITCH` and their nesting) are kept as ranges,
+     * so any combination of random values can be materialized without parsing again.
+     */
+    typedef struct bms_Source bms_Source;
+
+    /**
+     * Allocate Source Structure.
+     * @return Allocated source
+     */
+    BMS_API bms_Source *bms_source_alloc();
+
+    /**
+     * Free Source Structure.
+     * @param source Source to free
+     */
+    BMS_API void bms_source_free(bms_Source *source);
+
+    /**
+     * Tokenize BMS contents from file.
+     * Reads from the current position to the end; the file does not need to be seekable.
+     * @param source Source to fill with BMS contents
      * @param file File to get BMS contents from
      */
-    void bms_parse(bms_Chart *chart, FILE *file);
+    BMS_API void bms_source_parse(bms_Source *source, FILE *file);
+
+    /**
+     * Tokenize BMS contents from memory.
+     * @param source Source to fill with BMS contents
+     * @param data BMS contents
+     * @param size Size of the contents in bytes
+     */
+    BMS_API void bms_source_parse_buffer(bms_Source *source, const char *data, size_t size);
+
+    /**
+     * Number of `#RANDOM` and `#SWITCH` statements.
+     * Statements nested in other branches are counted too.
+     * @param source Source
+     * @return Number of random values a variant consists of
+     */
+    BMS_API size_t bms_source_randoms(const bms_Source *source);
+
+    /**
+     * Range of a `#RANDOM` or `#SWITCH` statement.
+     * @param source Source
+     * @param random Index of the random value
+     * @return Upper bound of the random value (1 ~ range)
+     */
+    BMS_API int bms_source_range(const bms_Source *source, size_t random);
+
+    /**
+     * Number of variants.
+     * Product of all ranges, or SIZE_MAX if it overflows.
+     * @param source Source
+     * @return Number of variants
+     */
+    BMS_API size_t bms_source_variants(const bms_Source *source);
+
+    /**
+     * Get random values of a variant.
+     * @param source Source
+     * @param variant Index of the variant (0 ~ variants - 1)
+     * @param values Array of `bms_source_randoms` random values to fill
+     */
+    BMS_API void bms_source_variant(const bms_Source *source, size_t variant, int *values);
+
+    /**
+     * Fill chart with the branches selected by random values.
+     * @param source Source
+     * @param chart Chart to fill with BMS contents
+     * @param values Array of `bms_source_randoms` random values
+     */
+    BMS_API void bms_source_materialize(const bms_Source *source, bms_Chart *chart, const int *values);
 
     /**
      * Resolve unresolved fraction.
@@ -369,15 +934,96 @@ extern "C"
      * @param fraction Unresolved fraction
      * @return Resolved fraction
      */
-    float bms_resolveFraction(const bms_Chart *chart, const float fraction);
+    BMS_API float bms_resolveFraction(const bms_Chart *chart, const float fraction);
+
+    /**
+     * Resolve unresolved fractions.
+     * Each one is a lookup in `measures`, in any order.
+     * @param chart Chart
+     * @param fractions Unresolved fractions
+     * @param positions Array to write the resolved fractions to
+     * @param size Number of fractions
+     */
+    BMS_API void bms_resolveFractions(const bms_Chart *chart, const float *fractions, float *positions, size_t size);
 
     /**
      * Convert time to fraction
+     * Takes time logarithmic in the number of sectors.
      * @param chart Chart
      * @param time Time
      * @return Resolved fraction
      */
-    float bms_timeToFraction(const bms_Chart *chart, const double time);
+    BMS_API float bms_timeToFraction(const bms_Chart *chart, const double time);
+
+    /**
+     * Convert times to fractions
+     * Ascending times, such as those of the notes on screen, are converted in one sweep over the sectors;
+     * a time smaller than the previous one costs a search.
+     * @param chart Chart
+     * @param times Times
+     * @param fractions Array to write the resolved fractions to
+     * @param size Number of times
+     */
+    BMS_API void bms_timesToFractions(const bms_Chart *chart, const double *times, float *fractions, size_t size);
+
+    /**
+     * Insert a tempo change into a parsed chart.
+     * Like every edit below, only the sectors, objects, long notes and lane notes from the edit onwards are retimed,
+     * and the cached statistics are invalidated.
+     * A tempo change at the position of others goes after them, so it is the one in effect.
+     * @param chart Parsed chart
+     * @param fraction Position in measure (Unresolved), 0 ~ 999
+     * @param delta BPM / 240, greater than 0
+     * @return Index of the sector, or 0 if nothing was inserted
+     */
+    BMS_API size_t bms_insert_tempo(bms_Chart *chart, float fraction, double delta);
+
+    /**
+     * Insert a stop into a parsed chart, as an inclusive sector of delta 0 followed by a non-inclusive one.
+     * @param chart Parsed chart
+     * @param fraction Position in measure (Unresolved), 0 ~ 999
+     * @param length Length in measures, as `#STOPxx` / 192
+     * @return Index of the non-inclusive sector, or 0 if nothing was inserted
+     */
+    BMS_API size_t bms_insert_stop(bms_Chart *chart, float fraction, double length);
+
+    /**
+     * Remove a sector from a parsed chart.
+     * Either sector of a stop removes the whole stop.
+     * @param chart Parsed chart
+     * @param index Index of the sector, not 0
+     * @return 1 if it was removed, 0 otherwise
+     */
+    BMS_API int bms_remove_sector(bms_Chart *chart, size_t index);
+
+    /**
+     * Change the tempo of an inclusive sector of a parsed chart, including the initial `#BPM` at index 0.
+     * The start of a stop is not a tempo change, its length is changed with bms_set_stop.
+     * @param chart Parsed chart
+     * @param index Index of the sector
+     * @param delta BPM / 240, greater than 0
+     * @return 1 if it was changed, 0 otherwise
+     */
+    BMS_API int bms_set_tempo(bms_Chart *chart, size_t index, double delta);
+
+    /**
+     * Change the length of the stop ending at a non-inclusive sector of a parsed chart.
+     * @param chart Parsed chart
+     * @param index Index of the sector
+     * @param length Length in measures, as `#STOPxx` / 192
+     * @return 1 if it was changed, 0 otherwise
+     */
+    BMS_API int bms_set_stop(bms_Chart *chart, size_t index, double length);
+
+    /**
+     * Change the signature of a measure of a parsed chart.
+     * Positions from the measure onwards are resolved again along with the times.
+     * @param chart Parsed chart
+     * @param measure Measure, 0 ~ 999
+     * @param signature Signature, greater than 0
+     * @return 1 if it was changed, 0 otherwise
+     */
+    BMS_API int bms_set_signature(bms_Chart *chart, int measure, float signature);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,254 @@
+#ifndef __BMSPARSER_HPP__
+#define __BMSPARSER_HPP__
+
+#include <bmsparser.h>
+#include <bmsparser/writer.h>
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/**
+ * C++17 wrapper of bmsparser.
+ * Views point into the chart without copying, and stay valid until it is reset, parsed into, moved from or destroyed.
+ */
+namespace bms
+{
+    /**
+     * Contiguous read-only view, like C++20 std::span.
+     */
+    template <typename T>
+    class Span
+    {
+    public:
+        using value_type = T;
+        using iterator = const T *;
+
+        constexpr Span() noexcept : data_(nullptr), size_(0) {}
+        constexpr Span(const T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+        constexpr const T *data() const noexcept { return data_; }
+        constexpr std::size_t size() const noexcept { return size_; }
+        constexpr bool empty() const noexcept { return size_ == 0; }
+        constexpr iterator begin() const noexcept { return data_; }
+        constexpr iterator end() const noexcept { return data_ + size_; }
+        constexpr const T &operator[](std::size_t i) const noexcept { return data_[i]; }
+        constexpr const T &front() const noexcept { return data_[0]; }
+        constexpr const T &back() const noexcept { return data_[size_ - 1]; }
+
+    private:
+        const T *data_;
+        std::size_t size_;
+    };
+
+    /**
+     * View of the objects of one type, in `objs` order.
+     */
+    class TypedObjs
+    {
+    public:
+        class iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = bms_Obj;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const bms_Obj *;
+            using reference = const bms_Obj &;
+
+            iterator() noexcept : obj_(nullptr), end_(nullptr), type_(bms_OBJTYPE_BGM) {}
+            iterator(const bms_Obj *obj, const bms_Obj *end, bms_Obj_Type type) noexcept : obj_(obj), end_(end), type_(type) { skip(); }
+
+            reference operator*() const noexcept { return *obj_; }
+            pointer operator->() const noexcept { return obj_; }
+            iterator &operator++() noexcept
+            {
+                ++obj_;
+                skip();
+                return *this;
+            }
+            iterator operator++(int) noexcept
+            {
+                iterator previous = *this;
+                ++*this;
+                return previous;
+            }
+            bool operator==(const iterator &other) const noexcept { return obj_ == other.obj_; }
+            bool operator!=(const iterator &other) const noexcept { return obj_ != other.obj_; }
+
+        private:
+            void skip() noexcept
+            {
+                while (obj_ != end_ && obj_->type != type_)
+                    ++obj_;
+            }
+
+            const bms_Obj *obj_;
+            const bms_Obj *end_;
+            bms_Obj_Type type_;
+        };
+
+        TypedObjs(Span<bms_Obj> objs, bms_Obj_Type type) noexcept : objs_(objs), type_(type) {}
+
+        iterator begin() const noexcept { return iterator(objs_.begin(), objs_.end(), type_); }
+        iterator end() const noexcept { return iterator(objs_.end(), objs_.end(), type_); }
+
+    private:
+        Span<bms_Obj> objs_;
+        bms_Obj_Type type_;
+    };
+
+    /**
+     * Owning, move-only handle of a bms_Chart.
+     */
+    class Chart
+    {
+    public:
+        /**
+         * Allocate an empty chart with the default allocator.
+         */
+        Chart() : chart_(bms_alloc()) {}
+
+        /**
+         * Allocate an empty chart with the given allocator.
+         * @param allocator Allocator of the chart buffers
+         */
+        explicit Chart(const bms_Allocator &allocator) : chart_(bms_alloc_with(&allocator)) {}
+
+        Chart(const Chart &) = delete;
+        Chart &operator=(const Chart &) = delete;
+
+        Chart(Chart &&other) noexcept : chart_(std::exchange(other.chart_, nullptr)) {}
+
+        Chart &operator=(Chart &&other) noexcept
+        {
+            std::swap(chart_, other.chart_);
+            return *this;
+        }
+
+        ~Chart()
+        {
+            if (chart_)
+                bms_free(chart_);
+        }
+
+        /**
+         * Parse BMS contents from file, see bms_parse_with.
+         */
+        void parse(std::FILE *file, const bms_ParseOptions *options = nullptr) { bms_parse_with(chart_, file, options); }
+
+        /**
+         * Parse BMS contents from memory, see bms_parse_buffer.
+         */
+        void parse(std::string_view data, const bms_ParseOptions *options = nullptr) { bms_parse_buffer(chart_, data.data(), data.size(), options); }
+
+        /**
+         * Write BMS text to file, see bms_write.
+         */
+        std::size_t write(std::FILE *file) const { return bms_write(chart_, file); }
+
+        /**
+         * BMS text of the chart, see bms_write_buffer.
+         */
+        std::string write() const
+        {
+            std::string text(bms_write_buffer(chart_, nullptr, 0), '\0');
+            bms_write_buffer(chart_, text.data(), text.size());
+            return text;
+        }
+
+        /**
+         * Clear the chart, keeping its buffers, see bms_reset.
+         */
+        void reset() { bms_reset(chart_); }
+
+        bms_Chart *get() noexcept { return chart_; }
+        const bms_Chart *get() const noexcept { return chart_; }
+        bms_Chart *operator->() noexcept { return chart_; }
+        const bms_Chart *operator->() const noexcept { return chart_; }
+
+        std::string_view genre() const noexcept { return text(chart_->genre); }
+        std::string_view title() const noexcept { return text(chart_->title); }
+        std::string_view subtitle() const noexcept { return text(chart_->subtitle); }
+        std::string_view artist() const noexcept { return text(chart_->artist); }
+        std::string_view subartist() const noexcept { return text(chart_->subartist); }
+        std::string_view stagefile() const noexcept { return text(chart_->stagefile); }
+        std::string_view banner() const noexcept { return text(chart_->banner); }
+
+        /**
+         * WAV of a key, empty if undefined.
+         * @param key Key, 0 ~ 1295
+         */
+        std::string_view wav(int key) const noexcept { return key >= 0 && key < 1296 ? text(chart_->wavs[key]) : std::string_view(); }
+
+        /**
+         * BMP of a key, empty if undefined.
+         * @param key Key, 0 ~ 1295
+         */
+        std::string_view bmp(int key) const noexcept { return key >= 0 && key < 1296 ? text(chart_->bmps[key]) : std::string_view(); }
+
+        /**
+         * Every WAV slot, NULL where undefined.
+         */
+        Span<char *> wavs() const noexcept { return Span<char *>(chart_->wavs, 1296); }
+
+        /**
+         * Every BMP slot, NULL where undefined.
+         */
+        Span<char *> bmps() const noexcept { return Span<char *>(chart_->bmps, 1296); }
+
+        Span<float> signatures() const noexcept { return Span<float>(chart_->signatures, 1000); }
+        Span<bms_Obj> objs() const noexcept { return Span<bms_Obj>(chart_->objs, chart_->objs_size); }
+        Span<bms_Sector> sectors() const noexcept { return Span<bms_Sector>(chart_->sectors, chart_->sectors_size); }
+        Span<bms_LongNote> longnotes() const noexcept { return Span<bms_LongNote>(chart_->longnotes, chart_->longnotes_size); }
+
+        /**
+         * Objects of one type.
+         */
+        TypedObjs objs(bms_Obj_Type type) const noexcept { return TypedObjs(objs(), type); }
+        TypedObjs bgms() const noexcept { return objs(bms_OBJTYPE_BGM); }
+        TypedObjs notes() const noexcept { return objs(bms_OBJTYPE_NOTE); }
+
+        /**
+         * Playable notes of a lane, see bms_lane_notes.
+         */
+        Span<bms_LaneNote> lane(int player, int line) const noexcept
+        {
+            std::size_t size;
+            const bms_LaneNote *notes = bms_lane_notes(chart_, player, line, &size);
+            return Span<bms_LaneNote>(notes, size);
+        }
+
+        /**
+         * Nearest note of a lane within a window, see bms_nearest_note.
+         */
+        long nearest_note(int player, int line, double time, double window) const noexcept { return bms_nearest_note(chart_, player, line, time, window); }
+
+        /**
+         * Cached statistics, see bms_compute_stats.
+         */
+        const bms_ChartStats &stats() { return *bms_compute_stats(chart_); }
+
+        float resolve(float fraction) const noexcept { return bms_resolveFraction(chart_, fraction); }
+        float fraction_at(double time) const noexcept { return bms_timeToFraction(chart_, time); }
+
+        /**
+         * Edits retiming the chart from the edit onwards, see bms_insert_tempo.
+         */
+        std::size_t insert_tempo(float fraction, double delta) noexcept { return bms_insert_tempo(chart_, fraction, delta); }
+        std::size_t insert_stop(float fraction, double length) noexcept { return bms_insert_stop(chart_, fraction, length); }
+        bool remove_sector(std::size_t index) noexcept { return bms_remove_sector(chart_, index); }
+        bool set_tempo(std::size_t index, double delta) noexcept { return bms_set_tempo(chart_, index, delta); }
+        bool set_stop(std::size_t index, double length) noexcept { return bms_set_stop(chart_, index, length); }
+        bool set_signature(int measure, float signature) noexcept { return bms_set_signature(chart_, measure, signature); }
+
+    private:
+        static std::string_view text(const char *s) noexcept { return s ? std::string_view(s) : std::string_view(); }
+
+        bms_Chart *chart_;
+    };
+}
+
+#endif
@@ -1,12 +1,14 @@
 #ifndef __BMSPARSER_CONVERT_H__
 #define __BMSPARSER_CONVERT_H__
 
+#include <bmsparser.h>
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-    void bms_sjis_to_utf8(const char *src, char *dst);
+    BMS_API void bms_sjis_to_utf8(const char *src, char *dst);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,66 @@
+#ifndef __BMSPARSER_FEED_H__
+#define __BMSPARSER_FEED_H__
+
+#include <bmsparser.h>
+#include <bmsparser/scheduler.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Single-producer single-consumer ring of events.
+     * One thread fills it from a scheduler ahead of time,
+     * another drains it without locks or allocations (e.g. an audio callback).
+     */
+    typedef struct bms_Feed bms_Feed;
+
+    /**
+     * Allocate Feed Structure.
+     * @param capacity Minimum number of events it can hold, rounded up to a power of two
+     * @return Allocated feed
+     */
+    BMS_API bms_Feed *bms_feed_alloc(size_t capacity);
+
+    /**
+     * Free Feed Structure.
+     * Neither thread may use it anymore.
+     * @param feed Feed to free
+     */
+    BMS_API void bms_feed_free(bms_Feed *feed);
+
+    /**
+     * Push scheduler events before the given time, in time order.
+     * Producer side. Events that do not fit are kept and pushed by the next call.
+     * @param feed Feed
+     * @param scheduler Scheduler to pop from, used only by the producer
+     * @param queues Bitmask of queues to pop, e.g. `1 << bms_QUEUE_BGM | 1 << bms_QUEUE_KEYSOUND`
+     * @param time Events with time < this are pushed
+     * @return Number of pushed events
+     */
+    BMS_API size_t bms_feed_fill(bms_Feed *feed, bms_Scheduler *scheduler, unsigned int queues, double time);
+
+    /**
+     * Drop the events popped from the scheduler but not pushed yet.
+     * Producer side. Call after seeking the scheduler; events already pushed stay in the feed.
+     * @param feed Feed
+     */
+    BMS_API void bms_feed_discard(bms_Feed *feed);
+
+    /**
+     * Pop events before the given time.
+     * Consumer side, wait-free.
+     * @param feed Feed
+     * @param time Events with time < this are popped
+     * @param events Array to copy the events to
+     * @param capacity Size of the array
+     * @return Number of popped events
+     */
+    BMS_API size_t bms_feed_drain(bms_Feed *feed, double time, bms_Obj *events, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
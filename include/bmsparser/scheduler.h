@@ -0,0 +1,92 @@
+#ifndef __BMSPARSER_SCHEDULER_H__
+#define __BMSPARSER_SCHEDULER_H__
+
+#include <bmsparser.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Event queues of a scheduler.
+     * Each queue has its own cursor, so consumers advance independently.
+     */
+    typedef enum bms_Queue
+    {
+        /**
+         * BGM objects, played regardless of input.
+         */
+        bms_QUEUE_BGM,
+
+        /**
+         * Note objects, for keysound preloading and autoplay.
+         */
+        bms_QUEUE_KEYSOUND,
+
+        /**
+         * BMP objects.
+         */
+        bms_QUEUE_BGA,
+
+        /**
+         * Note and bomb objects, for judgement.
+         */
+        bms_QUEUE_JUDGE,
+
+        /**
+         * Number of queues.
+         */
+        bms_QUEUE_COUNT,
+    } bms_Queue;
+
+    /**
+     * Time-ordered view of chart objects.
+     * It points into the chart, which must outlive it and stay unchanged.
+     */
+    typedef struct bms_Scheduler bms_Scheduler;
+
+    /**
+     * Allocate Scheduler Structure.
+     * @param chart Parsed chart
+     * @return Allocated scheduler with every cursor at the beginning
+     */
+    BMS_API bms_Scheduler *bms_scheduler_alloc(const bms_Chart *chart);
+
+    /**
+     * Free Scheduler Structure.
+     * @param scheduler Scheduler to free
+     */
+    BMS_API void bms_scheduler_free(bms_Scheduler *scheduler);
+
+    /**
+     * Pop every event of a queue before the given time.
+     * Takes time proportional to the number of popped events.
+     * @param scheduler Scheduler
+     * @param queue Queue to pop from
+     * @param time Events with time < this are popped
+     * @param events Set to the popped events, in time order, valid until the scheduler is freed
+     * @return Number of popped events
+     */
+    BMS_API size_t bms_scheduler_pop(bms_Scheduler *scheduler, bms_Queue queue, double time, const bms_Obj *const **events);
+
+    /**
+     * Time of the next event of a queue.
+     * @param scheduler Scheduler
+     * @param queue Queue
+     * @return Time of the next event, or HUGE_VAL if the queue is exhausted
+     */
+    BMS_API double bms_scheduler_peek(const bms_Scheduler *scheduler, bms_Queue queue);
+
+    /**
+     * Move every cursor to the first event at or after the given time.
+     * @param scheduler Scheduler
+     * @param time Time to seek to
+     */
+    BMS_API void bms_scheduler_seek(bms_Scheduler *scheduler, double time);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef __BMSPARSER_SCORING_H__
+#define __BMSPARSER_SCORING_H__
+
+#include <bmsparser.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Judgement of a hit.
+     */
+    typedef enum bms_Judge
+    {
+        /**
+         * Perfect Great.
+         */
+        bms_JUDGE_PGREAT,
+
+        /**
+         * Great.
+         */
+        bms_JUDGE_GREAT,
+
+        /**
+         * Good.
+         */
+        bms_JUDGE_GOOD,
+
+        /**
+         * Bad, breaks the combo.
+         */
+        bms_JUDGE_BAD,
+
+        /**
+         * Poor, a note passed without being hit.
+         */
+        bms_JUDGE_POOR,
+
+        /**
+         * Empty Poor, a key pressed with no note in the Bad window.
+         */
+        bms_JUDGE_EMPTY_POOR,
+
+        /**
+         * Number of judgements.
+         */
+        bms_JUDGE_COUNT,
+    } bms_Judge;
+
+    /**
+     * Scoring Profile Structure.
+     * Everything scoring needs per hit, computed once per chart.
+     */
+    typedef struct bms_ScoringProfile
+    {
+        /**
+         * Playable notes, see bms_ChartStats.
+         */
+        size_t notes;
+
+        /**
+         * Rank of the chart, selecting the row of `windows` used by bms_scoring_judge.
+         */
+        bms_Rank rank;
+
+        /**
+         * Judge windows in seconds, as in LR2.
+         * `windows[rank][judge]` is the largest |offset| judged `judge`, for Perfect Great ~ Bad.
+         */
+        double windows[bms_RANK_EASY + 1][bms_JUDGE_BAD + 1];
+
+        /**
+         * Groove gauge change per judgement, in percent.
+         * Perfect Great and Great add TOTAL / notes, Good half of it.
+         */
+        double gauge[bms_JUDGE_COUNT];
+    } bms_ScoringProfile;
+
+    /**
+     * Compute the scoring profile of a parsed chart.
+     * @param chart Parsed chart, its statistics are computed if needed
+     * @param profile Profile to fill
+     */
+    BMS_API void bms_scoring_profile(bms_Chart *chart, bms_ScoringProfile *profile);
+
+    /**
+     * Judge a hit with the windows of the chart's rank.
+     * @param profile Scoring profile
+     * @param offset Hit time minus note time in seconds
+     * @return Judgement, bms_JUDGE_EMPTY_POOR if outside the Bad window
+     */
+    BMS_API bms_Judge bms_scoring_judge(const bms_ScoringProfile *profile, double offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __BMSPARSER_WRITER_H__
+#define __BMSPARSER_WRITER_H__
+
+#include <bmsparser.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Write a chart as BMS text to file.
+     * Headers, definitions, signatures, sectors (channels 03, 08, 09) and objects are written in one pass,
+     * each channel of a measure on as few lines as possible, with the fewest slots that place every object exactly.
+     * Parsing the text gives the same objects, sectors and times, except that:
+     * - paired long notes are written on channels 5x and 6x, and unpaired long note ends with `#LNOBJ`,
+     * - objects at the same position on different channels may come out in another order.
+     * @param chart Parsed chart
+     * @param file File to write to
+     * @return Bytes written, less than the size of the text if writing failed
+     */
+    BMS_API size_t bms_write(const bms_Chart *chart, FILE *file);
+
+    /**
+     * Write a chart as BMS text to memory, see bms_write.
+     * The text is not null-terminated.
+     * @param chart Parsed chart
+     * @param data Buffer to write to, or NULL if capacity is 0
+     * @param capacity Size of the buffer
+     * @return Size of the text, which is complete if it is not larger than capacity
+     */
+    BMS_API size_t bms_write_buffer(const bms_Chart *chart, char *data, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
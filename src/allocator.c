@@ -0,0 +1,38 @@
+#include "allocator.h"
+#include <stdlib.h>
+
+static void *standardRealloc(void *user, void *ptr, size_t old_size, size_t size)
+{
+    (void)user;
+    (void)old_size;
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, size);
+}
+
+static const bms_Allocator standard = {standardRealloc, NULL};
+static bms_Allocator current = {standardRealloc, NULL};
+
+void bms_set_allocator(const bms_Allocator *allocator)
+{
+    current = allocator ? *allocator : standard;
+}
+
+const bms_Allocator *bms_default_allocator()
+{
+    return &current;
+}
+
+void *bms_allocate(const bms_Allocator *allocator, void *ptr, size_t old_size, size_t size)
+{
+    return allocator->realloc(allocator->user, ptr, old_size, size);
+}
+
+void bms_release(const bms_Allocator *allocator, void *ptr, size_t size)
+{
+    if (ptr)
+        allocator->realloc(allocator->user, ptr, size, 0);
+}
@@ -0,0 +1,12 @@
+#ifndef __BMSPARSER_ALLOCATOR_H__
+#define __BMSPARSER_ALLOCATOR_H__
+
+#include <bmsparser.h>
+
+const bms_Allocator *bms_default_allocator();
+
+void *bms_allocate(const bms_Allocator *allocator, void *ptr, size_t old_size, size_t size);
+
+void bms_release(const bms_Allocator *allocator, void *ptr, size_t size);
+
+#endif
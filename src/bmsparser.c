@@ -3,14 +3,253 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
 #include <regex.h>
+#include <math.h>
+#include <pthread.h>
+#include "allocator.h"
+#include "channels.h"
 #include "sort.h"
 
+typedef enum StatementType
+{
+    STATEMENT_RANDOM,
+    STATEMENT_SETRANDOM,
+    STATEMENT_ENDRANDOM,
+    STATEMENT_IF,
+    STATEMENT_ELSEIF,
+    STATEMENT_ELSE,
+    STATEMENT_ENDIF,
+    STATEMENT_SWITCH,
+    STATEMENT_SETSWITCH,
+    STATEMENT_CASE,
+    STATEMENT_DEF,
+    STATEMENT_SKIP,
+    STATEMENT_ENDSW,
+    STATEMENT_GENRE,
+    STATEMENT_TITLE,
+    STATEMENT_SUBTITLE,
+    STATEMENT_ARTIST,
+    STATEMENT_SUBARTIST,
+    STATEMENT_STAGEFILE,
+    STATEMENT_BANNER,
+    STATEMENT_PLAYLEVEL,
+    STATEMENT_DIFFICULTY,
+    STATEMENT_TOTAL,
+    STATEMENT_RANK,
+    STATEMENT_WAV,
+    STATEMENT_BMP,
+    STATEMENT_LNOBJ,
+    STATEMENT_BPM,
+    STATEMENT_BPMS,
+    STATEMENT_STOP,
+    STATEMENT_SIGNATURE,
+    STATEMENT_CHANNEL,
+} StatementType;
+
+/*
+ * One tokenized line.
+ * RANDOM, SWITCH: key is the range, random is the index into ranges.
+ * SETRANDOM, SETSWITCH, IF, ELSEIF, CASE: key is the value.
+ * IF, ELSEIF, ELSE: jump is the next branch, end is the matching ENDIF.
+ * SWITCH, SETSWITCH, CASE, DEF: jump is the next label, end is the matching ENDSW.
+ * SKIP: jump is the enclosing SWITCH or SETSWITCH.
+ * CHANNEL, SIGNATURE: key is the measure.
+ * CHANNEL: slots is the number of keys that decode to something other than 0.
+ * WAV, BMP, BPMS, STOP: key is the index.
+ */
+typedef struct Statement
+{
+    StatementType type;
+    int key;
+    int channel;
+    double value;
+    size_t text;
+    size_t length;
+    size_t random;
+    size_t jump;
+    size_t end;
+    size_t slots;
+} Statement;
+
+/*
+ * Accounting of a parse with statistics.
+ */
+typedef struct Meter
+{
+    bms_ParseStats *stats;
+    size_t memory;
+} Meter;
+
+typedef enum BlockType
+{
+    BLOCK_IF,
+    BLOCK_SWITCH,
+} BlockType;
+
+typedef struct Block
+{
+    BlockType type;
+    size_t opener;
+    size_t last;
+} Block;
+
+/*
+ * blocks is scratch of linkBlocks, kept with the source so linking again does not allocate.
+ */
+struct bms_Source
+{
+    bms_Allocator allocator;
+    Meter *meter;
+
+    Statement *statements;
+    size_t statements_size;
+    size_t statements_capacity;
+
+    char *text;
+    size_t text_size;
+    size_t text_capacity;
+
+    int *ranges;
+    size_t ranges_size;
+    size_t ranges_capacity;
+
+    Block *blocks;
+    size_t blocks_capacity;
+};
+
+#define READ_CHUNK 4096
+
+/*
+ * Lines come either from a buffer or from a file read in fixed chunks,
+ * so files never need to be seekable and memory stays O(longest line).
+ */
+typedef struct Reader
+{
+    const bms_Allocator *allocator;
+    FILE *file;
+    const char *data;
+    size_t size;
+    size_t position;
+    char *line;
+    size_t capacity;
+    char *chunk;
+    size_t chunk_begin;
+    size_t chunk_end;
+} Reader;
+
+typedef struct Patterns
+{
+    regex_t random;
+    regex_t setrandom;
+    regex_t endrandom;
+    regex_t if_;
+    regex_t elseif;
+    regex_t else_;
+    regex_t endif;
+    regex_t switch_;
+    regex_t setswitch;
+    regex_t case_;
+    regex_t def;
+    regex_t skip;
+    regex_t endsw;
+    regex_t genre;
+    regex_t title;
+    regex_t nestedSubtitle;
+    regex_t subtitle;
+    regex_t artist;
+    regex_t subartist;
+    regex_t stagefile;
+    regex_t banner;
+    regex_t playlevel;
+    regex_t difficulty;
+    regex_t total;
+    regex_t rank;
+    regex_t lnobj;
+    regex_t bpm;
+    regex_t bpms;
+    regex_t stops;
+    regex_t signature;
+    regex_t notes;
+} Patterns;
+
+/*
+ * One bit per base-36 key (00 ~ ZZ).
+ */
+#define KEYSET_SIZE ((1296 + 7) / 8)
+
+/*
+ * Position in nested control flow.
+ * randoms[d] is the random value of nesting level d,
+ * blocks[d] is the block that opened level d (d > 0).
+ */
+typedef struct Flow
+{
+    const bms_Allocator *allocator;
+    Meter *meter;
+    int *randoms;
+    BlockType *blocks;
+    size_t depth;
+    size_t capacity;
+} Flow;
+
+typedef struct State
+{
+    const bms_Allocator *allocator;
+    Meter *meter;
+    Flow flow;
+    unsigned char lnobj[KEYSET_SIZE];
+    unsigned char bpms_defined[KEYSET_SIZE];
+    unsigned char stops_defined[KEYSET_SIZE];
+    double bpms[1296];
+    float stops[1296];
+    unsigned char lnflag[20];
+} State;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *meterRealloc(Meter *meter, const bms_Allocator *allocator, void *ptr, size_t old_size, size_t size)
+{
+    if (meter)
+    {
+        meter->stats->allocations++;
+        meter->memory = meter->memory - old_size + size;
+        if (meter->memory > meter->stats->peak_memory)
+            meter->stats->peak_memory = meter->memory;
+    }
+    return bms_allocate(allocator, ptr, old_size, size);
+}
+
+static void meterFree(Meter *meter, const bms_Allocator *allocator, void *ptr, size_t size)
+{
+    if (meter)
+        meter->memory -= size;
+    bms_release(allocator, ptr, size);
+}
+
+static void keySetAdd(unsigned char *set, int key)
+{
+    set[key >> 3] |= 1 << (key & 7);
+}
+
+static int keySetHas(const unsigned char *set, int key)
+{
+    return set[key >> 3] >> (key & 7) & 1;
+}
+
+static void destroyParser(bms_Parser *parser);
+
 static unsigned char sectcomp(void *a, void *b)
 {
     bms_Sector *n = (bms_Sector *)a;
     bms_Sector *m = (bms_Sector *)b;
-    return n->fraction < m->fraction;
+    return n->fraction < m->fraction || n->fraction == m->fraction && n->inclusive && !m->inclusive;
 }
 
 static unsigned char objcomp(void *a, void *b)
@@ -21,9 +260,40 @@ static unsigned char objcomp(void *a, void *b)
 }
 
 bms_Chart *bms_alloc()
+{
+    return bms_alloc_with(NULL);
+}
+
+bms_Chart *bms_alloc_with(const bms_Allocator *allocator)
+{
+    if (!allocator)
+        allocator = bms_default_allocator();
+    bms_Chart *chart = bms_allocate(allocator, NULL, 0, sizeof(bms_Chart));
+    chart->allocator = *allocator;
+    chart->wavs = bms_allocate(allocator, NULL, 0, sizeof(char *) * 1296);
+    chart->bmps = bms_allocate(allocator, NULL, 0, sizeof(char *) * 1296);
+    chart->signatures = bms_allocate(allocator, NULL, 0, sizeof(float) * 1000);
+    chart->measures = bms_allocate(allocator, NULL, 0, sizeof(float) * 1001);
+    chart->objs = NULL;
+    chart->objs_capacity = 0;
+    chart->sectors = bms_allocate(allocator, NULL, 0, sizeof(bms_Sector));
+    chart->sectors_capacity = 1;
+    chart->longnotes = NULL;
+    chart->longnotes_capacity = 0;
+    chart->lanes = NULL;
+    chart->lanes_capacity = 0;
+    chart->text = NULL;
+    chart->text_capacity = 0;
+    chart->stats.density = NULL;
+    chart->stats.density_capacity = 0;
+    chart->parser = NULL;
+    bms_reset(chart);
+    return chart;
+}
+
+void bms_reset(bms_Chart *chart)
 {
     size_t i;
-    bms_Chart *chart = malloc(sizeof(bms_Chart));
     chart->genre = NULL;
     chart->title = NULL;
     chart->subtitle = NULL;
@@ -35,690 +305,2398 @@ bms_Chart *bms_alloc()
     chart->difficulty = bms_DIFFICULTY_NORMAL;
     chart->total = 160;
     chart->rank = bms_RANK_NORMAL;
-    chart->wavs = malloc(sizeof(char *) * 1296);
-    chart->bmps = malloc(sizeof(char *) * 1296);
     for (i = 0; i < 1296; i++)
     {
         chart->wavs[i] = NULL;
         chart->bmps[i] = NULL;
     }
-    chart->signatures = malloc(sizeof(float) * 1000);
     for (i = 0; i < 1000; i++)
     {
         chart->signatures[i] = 1.0f;
     }
-    chart->objs = NULL;
+    for (i = 0; i <= 1000; i++)
+    {
+        chart->measures[i] = (float)i;
+    }
     chart->objs_size = 0;
-    chart->sectors = malloc(sizeof(bms_Sector));
+    chart->longnotes_size = 0;
+    memset(chart->lane_offsets, 0, sizeof(chart->lane_offsets));
+    chart->text_size = 0;
     chart->sectors[0].fraction = 0;
+    chart->sectors[0].position = 0;
     chart->sectors[0].time = 0;
     chart->sectors[0].delta = 130.0 / 240.0;
+    chart->sectors[0].stop = 0;
     chart->sectors[0].inclusive = 1;
     chart->sectors_size = 1;
-    return chart;
+    chart->stats_valid = 0;
 }
 
 void bms_free(bms_Chart *chart)
 {
-    size_t i;
-    free(chart->genre);
-    free(chart->title);
-    free(chart->subtitle);
-    free(chart->artist);
-    free(chart->subartist);
-    free(chart->stagefile);
-    free(chart->banner);
-    for (i = 0; i < 1296; i++)
-    {
-        free(chart->bmps[i]);
-        free(chart->wavs[i]);
-    }
-    free(chart->wavs);
-    free(chart->bmps);
-    free(chart->signatures);
-    free(chart->objs);
-    free(chart->sectors);
-    free(chart);
+    bms_Allocator allocator = chart->allocator;
+    if (chart->parser)
+        destroyParser(chart->parser);
+    bms_release(&allocator, chart->wavs, sizeof(char *) * 1296);
+    bms_release(&allocator, chart->bmps, sizeof(char *) * 1296);
+    bms_release(&allocator, chart->signatures, sizeof(float) * 1000);
+    bms_release(&allocator, chart->measures, sizeof(float) * 1001);
+    bms_release(&allocator, chart->objs, sizeof(bms_Obj) * chart->objs_capacity);
+    bms_release(&allocator, chart->sectors, sizeof(bms_Sector) * chart->sectors_capacity);
+    bms_release(&allocator, chart->longnotes, sizeof(bms_LongNote) * chart->longnotes_capacity);
+    bms_release(&allocator, chart->lanes, sizeof(bms_LaneNote) * chart->lanes_capacity);
+    bms_release(&allocator, chart->text, sizeof(char) * chart->text_capacity);
+    bms_release(&allocator, chart->stats.density, sizeof(size_t) * chart->stats.density_capacity);
+    bms_release(&allocator, chart, sizeof(bms_Chart));
+}
+
+/*
+ * Resolved position of a fraction, from the measure table.
+ * Measures outside 0 ~ 999 have a signature of 1.
+ */
+static float resolve(const bms_Chart *chart, float fraction)
+{
+    int measure = (int)fraction;
+    if (fraction < 0)
+        return fraction;
+    if (measure >= 1000)
+        return chart->measures[1000] + (fraction - 1000);
+    return chart->measures[measure] + (fraction - measure) * chart->signatures[measure];
 }
 
-static float fractionDiff(float *signatures, float a, float b)
+/*
+ * Recompute the measure table from a measure onwards.
+ */
+static void resolveMeasures(bms_Chart *chart, int from)
 {
-    unsigned char negative = a > b;
-    if (negative)
+    int i;
+    chart->measures[0] = 0;
+    for (i = from; i < 1000; i++)
     {
-        float temp = a;
-        a = b;
-        b = temp;
+        chart->measures[i + 1] = chart->measures[i] + chart->signatures[i];
     }
+}
+
+/*
+ * Resolved length from fraction a to fraction b, from the measure table, so far measures cost no more than near ones.
+ */
+static float fractionDiff(const bms_Chart *chart, float a, float b)
+{
     int aM = (int)a;
     int bM = (int)b;
-    float aF = a - aM;
-    float bF = b - bM;
-    float result = bF * (bM >= 0 ? signatures[bM] : 1) - aF * (aM >= 0 ? signatures[aM] : 1);
-    int i;
-    for (i = aM; i < bM; i++)
+    if (a < 0 || b < 0 || aM >= 1000 || bM >= 1000)
+        return resolve(chart, b) - resolve(chart, a);
+    return (chart->measures[bM] - chart->measures[aM]) + ((b - bM) * chart->signatures[bM] - (a - aM) * chart->signatures[aM]);
+}
+
+static void compilePatterns(Patterns *patterns)
+{
+    regcomp(&patterns->random, "^\\s*#RANDOM\\s*([0-9]+)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->setrandom, "^\\s*#SETRANDOM\\s*([0-9]+)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->endrandom, "^\\s*#ENDRANDOM\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->if_, "^\\s*#IF\\s*([0-9]+)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->elseif, "^\\s*#ELSEIF\\s*([0-9]+)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->else_, "^\\s*#ELSE\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->endif, "^\\s*#ENDIF\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->switch_, "^\\s*#SWITCH\\s*([0-9]+)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->setswitch, "^\\s*#SETSWITCH\\s*([0-9]+)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->case_, "^\\s*#CASE\\s*([0-9]+)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->def, "^\\s*#DEF\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->skip, "^\\s*#SKIP\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->endsw, "^\\s*#ENDSW\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->genre, "^\\s*#GENRE\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->title, "^\\s*#TITLE\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->nestedSubtitle, "^\\s*(.*)\\s*\\[(.*)\\]\\s*$", REG_EXTENDED);
+    regcomp(&patterns->subtitle, "^\\s*#SUBTITLE\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->artist, "^\\s*#ARTIST\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->subartist, "^\\s*#SUBARTIST\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->stagefile, "^\\s*#STAGEFILE\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->banner, "^\\s*#BANNER\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->playlevel, "^\\s*#PLAYLEVEL\\s*([0-9]+)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->difficulty, "^\\s*#DIFFICULTY\\s*([12345])\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->total, "^\\s*#TOTAL\\s*([0-9]+(\\.[0-9]+)?)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->rank, "^\\s*#RANK\\s*([0123])\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->lnobj, "^\\s*#LNOBJ\\s*([0-9A-Z]{2})\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->bpm, "^\\s*#BPM\\s*([0-9]+(\\.[0-9]+)?(E\\+[0-9]+)?)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->bpms, "^\\s*#BPM([0-9A-Z]{2})\\s*([0-9]+(\\.[0-9]+)?(E\\+[0-9]+)?)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->stops, "^\\s*#STOP([0-9A-Z]{2})\\s*([0-9]+)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->signature, "^\\s*#([0-9]{3})02:([0-9]+(\\.[0-9]+)?(E\\+[0-9]+)?)\\s*$", REG_ICASE | REG_EXTENDED);
+    regcomp(&patterns->notes, "^\\s*#([0-9]{3})([0-9A-Z]{2}):(.*)\\s*$", REG_ICASE | REG_EXTENDED);
+}
+
+static Patterns patterns;
+static pthread_once_t patternsOnce = PTHREAD_ONCE_INIT;
+
+static void compileSharedPatterns()
+{
+    compilePatterns(&patterns);
+}
+
+/*
+ * Patterns compiled on first use and kept for the life of the process.
+ * They are only read afterwards, so every parse and every tokenizing thread shares them.
+ */
+static const Patterns *sharedPatterns()
+{
+    pthread_once(&patternsOnce, compileSharedPatterns);
+    return &patterns;
+}
+
+static double captureNumber(char *line, regmatch_t match)
+{
+    char c = line[match.rm_eo];
+    line[match.rm_eo] = '\0';
+    double number = atof(line + match.rm_so);
+    line[match.rm_eo] = c;
+    return number;
+}
+
+static int captureKey(char *line, regmatch_t match)
+{
+    char c = line[match.rm_eo];
+    line[match.rm_eo] = '\0';
+    int key = strtol(line + match.rm_so, NULL, 36);
+    line[match.rm_eo] = c;
+    return key;
+}
+
+static Statement *pushStatement(bms_Source *source, StatementType type)
+{
+    if (source->statements_size == source->statements_capacity)
     {
-        if (i >= 0)
-        {
-            result += signatures[i];
-        }
-        else
-        {
-            result += 1;
-        }
+        size_t capacity = source->statements_capacity ? source->statements_capacity * 2 : 64;
+        source->statements = meterRealloc(source->meter, &source->allocator, source->statements, sizeof(Statement) * source->statements_capacity, sizeof(Statement) * capacity);
+        source->statements_capacity = capacity;
     }
-    if (negative)
+    Statement *statement = source->statements + source->statements_size++;
+    statement->type = type;
+    statement->key = 0;
+    statement->channel = 0;
+    statement->value = 0;
+    statement->text = 0;
+    statement->length = 0;
+    statement->random = 0;
+    statement->jump = 0;
+    statement->end = 0;
+    statement->slots = 0;
+    return statement;
+}
+
+static void pushText(bms_Source *source, Statement *statement, const char *line, regmatch_t match)
+{
+    size_t length = match.rm_eo - match.rm_so;
+    while (length > 0 && isspace((unsigned char)line[match.rm_so + length - 1]))
+        length--;
+    while (source->text_size + length + 1 > source->text_capacity)
     {
-        result = -result;
+        size_t capacity = source->text_capacity ? source->text_capacity * 2 : 1024;
+        source->text = meterRealloc(source->meter, &source->allocator, source->text, sizeof(char) * source->text_capacity, sizeof(char) * capacity);
+        source->text_capacity = capacity;
     }
-    return result;
+    memcpy(source->text + source->text_size, line + match.rm_so, sizeof(char) * length);
+    source->text[source->text_size + length] = '\0';
+    statement->text = source->text_size;
+    statement->length = length;
+    source->text_size += length + 1;
 }
 
-void bms_parse(bms_Chart *chart, FILE *input)
+/*
+ * Value of a two-character slot, read like strtol would: a missing second digit ends the number,
+ * and leading blanks or '+' are skipped. Anything else, including a sign, gives 0.
+ */
+static int slotValue(const char *slot, int base)
 {
-    regex_t randomRegex;
-    regcomp(&randomRegex, "^\\s*#RANDOM\\s*(\\d+)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t ifRegex;
-    regcomp(&ifRegex, "^\\s*#IF\\s*(\\d+)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t elseRegex;
-    regcomp(&elseRegex, "^\\s*#ELSE\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t endifRegex;
-    regcomp(&endifRegex, "^\\s*#ENDIF\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t genreRegex;
-    regcomp(&genreRegex, "^\\s*#GENRE\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t titleRegex;
-    regcomp(&titleRegex, "^\\s*#TITLE\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t nestedSubtitleRegex;
-    regcomp(&nestedSubtitleRegex, "^\\s*(.*)\\s*\\[(.*)\\]\\s*$", REG_EXTENDED);
-    regex_t subtitleRegex;
-    regcomp(&subtitleRegex, "^\\s*#SUBTITLE\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t artistRegex;
-    regcomp(&artistRegex, "^\\s*#ARTIST\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t subartistRegex;
-    regcomp(&subartistRegex, "^\\s*#SUBARTIST\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t stagefileRegex;
-    regcomp(&stagefileRegex, "^\\s*#STAGEFILE\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t bannerRegex;
-    regcomp(&bannerRegex, "^\\s*#BANNER\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t playlevelRegex;
-    regcomp(&playlevelRegex, "^\\s*#PLAYLEVEL\\s*(\\d+)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t difficultyRegex;
-    regcomp(&difficultyRegex, "^\\s*#DIFFICULTY\\s*([12345])\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t totalRegex;
-    regcomp(&totalRegex, "^\\s*#TOTAL\\s*(\\d+(\\.\\d+)?)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t rankRegex;
-    regcomp(&rankRegex, "^\\s*#RANK\\s*([0123])\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t wavsRegex;
-    regcomp(&wavsRegex, "^\\s*#WAV([0-9A-Z]{2})\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t bmpsRegex;
-    regcomp(&bmpsRegex, "^\\s*#BMP([0-9A-Z]{2})\\s*(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t lnobjRegex;
-    regcomp(&lnobjRegex, "^\\s*#LNOBJ\\s*([0-9A-Z]{2})\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t bpmRegex;
-    regcomp(&bpmRegex, "^\\s*#BPM\\s*(\\d+(\\.\\d+)?(E\\+\\d+)?)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t bpmsRegex;
-    regcomp(&bpmsRegex, "^\\s*#BPM([0-9A-Z]{2})\\s*(\\d+(\\.\\d+)?(E\\+\\d+)?)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t stopsRegex;
-    regcomp(&stopsRegex, "^\\s*#STOP([0-9A-Z]{2})\\s*(\\d+)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t signatureRegex;
-    regcomp(&signatureRegex, "^\\s*#(\\d{3})02:(\\d+(\\.\\d+)?(E\\+\\d+)?)\\s*$", REG_ICASE | REG_EXTENDED);
-    regex_t notesRegex;
-    regcomp(&notesRegex, "^\\s*#(\\d{3})([0-9A-Z]{2}):(.*)\\s*$", REG_ICASE | REG_EXTENDED);
-
-    fseek(input, 0, SEEK_END);
-    long size = ftell(input);
-    char *line = malloc(size);
-    fseek(input, 0, SEEK_SET);
-
-    srand(time(NULL));
-    int random = 0;
+    int high = digits[(unsigned char)slot[0]] - 1;
+    int low = digits[(unsigned char)slot[1]] - 1;
+    if (low >= base)
+        low = -1;
+    if (high >= 0 && high < base)
+        return low >= 0 ? high * base + low : high;
+    if (slot[0] == '+' || isspace((unsigned char)slot[0]))
+        return low >= 0 ? low : 0;
+    return 0;
+}
 
-    unsigned char *skip = malloc(sizeof(unsigned char));
-    size_t nb_skip = 1;
-    size_t skip_length = 1;
-    skip[0] = 0;
-    int *lnobj = malloc(sizeof(int));
-    size_t nb_lnobj = 1;
-    size_t lnobj_length = 0;
-    double *bpms = malloc(sizeof(double) * 1296);
-    float *stops = malloc(sizeof(float) * 1296);
+/*
+ * Most capture groups of a pattern, and the whole match.
+ */
+#define CAPTURES 5
 
-    unsigned char lnflag[20] = {0};
+/*
+ * What follows the # of a line, if it starts with one after blanks as every pattern requires.
+ */
+static const char *directive(const char *line)
+{
+    while (isspace((unsigned char)*line))
+        line++;
+    return *line == '#' ? line + 1 : NULL;
+}
 
-    size_t nb_objs = 0;
-    size_t nb_sectors = 1;
+/*
+ * Match a line against the notes pattern, ^\s*#([0-9]{3})([0-9A-Z]{2}):(.*)\s*$ ignoring case, without regexec.
+ * Channel lines are most of a chart, and regexec also takes a lock per pattern that tokenizing threads would contend on,
+ * so they and the #WAV and #BMP definitions are matched by hand.
+ */
+static int matchChannel(const char *line, const char *head, regmatch_t *match)
+{
+    if (!isdigit((unsigned char)head[0]) || !isdigit((unsigned char)head[1]) || !isdigit((unsigned char)head[2]) ||
+        !digits[(unsigned char)head[3]] || !digits[(unsigned char)head[4]] || head[5] != ':')
+        return 0;
+    match[1].rm_so = head - line;
+    match[1].rm_eo = head + 3 - line;
+    match[2].rm_so = head + 3 - line;
+    match[2].rm_eo = head + 5 - line;
+    match[3].rm_so = head + 6 - line;
+    match[3].rm_eo = match[3].rm_so + strlen(head + 6);
+    return 1;
+}
 
+static void pushChannel(bms_Source *source, char *line, const regmatch_t *match)
+{
+    Statement *statement = pushStatement(source, STATEMENT_CHANNEL);
+    statement->key = (int)captureNumber(line, match[1]);
+    statement->channel = captureKey(line, match[2]);
+    pushText(source, statement, line, match[3]);
+    const char *text = source->text + statement->text;
     size_t i;
+    for (i = 0; i + 1 < statement->length; i += 2)
+    {
+        statement->slots += slotValue(text + i, 36) != 0;
+    }
+}
 
-    while (fgets(line, size, input))
+/*
+ * Whether a directive starts with a keyword, ignoring case.
+ */
+static int hasKeyword(const char *head, const char *keyword)
+{
+    for (; *keyword; keyword++, head++)
     {
-        if (strrchr(line, '\r'))
-            *strrchr(line, '\r') = '\0';
-        else if (strrchr(line, '\n'))
-            *strrchr(line, '\n') = '\0';
+        if (toupper((unsigned char)*head) != *keyword)
+            return 0;
+    }
+    return 1;
+}
 
-        regmatch_t match[5];
+/*
+ * Match a line against a definition pattern, ^\s*#KEYWORD([0-9A-Z]{2})\s*(.*)\s*$ ignoring case, without regexec.
+ */
+static int matchDefinition(const char *line, const char *head, const char *keyword, regmatch_t *match)
+{
+    const char *p;
+    if (!hasKeyword(head, keyword))
+        return 0;
+    p = head + strlen(keyword);
+    if (!digits[(unsigned char)p[0]] || !digits[(unsigned char)p[1]])
+        return 0;
+    match[1].rm_so = p - line;
+    match[1].rm_eo = p + 2 - line;
+    for (p += 2; isspace((unsigned char)*p); p++)
+        ;
+    match[2].rm_so = p - line;
+    match[2].rm_eo = match[2].rm_so + strlen(p);
+    return 1;
+}
 
-        if (regexec(&randomRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            free(str);
-            random = rand() % atoi(str) + 1;
-        }
-        else if (regexec(&ifRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            if (nb_skip == skip_length)
-            {
-                nb_skip *= 2;
-                skip = realloc(skip, sizeof(unsigned char) * nb_skip);
-            }
-            skip[skip_length++] = atoi(str) != random;
-            free(str);
-        }
-        else if (regexec(&elseRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            skip[skip_length - 1] = !skip[skip_length - 1];
-        }
-        else if (regexec(&endifRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            skip_length--;
-        }
+/*
+ * Run a pattern only on lines whose directive starts with its keyword.
+ * A line is tried against a handful of patterns instead of all of them.
+ * Patterns starting with a measure number have an empty keyword and want a digit.
+ */
+static int matchPattern(const regex_t *pattern, const char *keyword, const char *head, const char *line, regmatch_t *match)
+{
+    if (!*keyword && !isdigit((unsigned char)*head))
+        return 0;
+    return hasKeyword(head, keyword) && regexec(pattern, line, CAPTURES, match, 0) == 0;
+}
 
-        if (skip[skip_length - 1])
-        {
-            continue;
-        }
+static void tokenize(bms_Source *source, const Patterns *patterns, char *line)
+{
+    regmatch_t match[CAPTURES];
+    Statement *statement;
+    const char *head = directive(line);
 
-        if (regexec(&genreRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
+    if (!head)
+        return;
+    // Only measure lengths (channel 02) can match an earlier pattern than notes.
+    if (matchChannel(line, head, match) && (line[match[2].rm_so] != '0' || line[match[2].rm_so + 1] != '2'))
+        pushChannel(source, line, match);
+    else if (matchPattern(&patterns->random, "RANDOM", head, line, match))
+    {
+        pushStatement(source, STATEMENT_RANDOM)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->setrandom, "SETRANDOM", head, line, match))
+    {
+        pushStatement(source, STATEMENT_SETRANDOM)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->endrandom, "ENDRANDOM", head, line, match))
+    {
+        pushStatement(source, STATEMENT_ENDRANDOM);
+    }
+    else if (matchPattern(&patterns->if_, "IF", head, line, match))
+    {
+        pushStatement(source, STATEMENT_IF)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->elseif, "ELSEIF", head, line, match))
+    {
+        pushStatement(source, STATEMENT_ELSEIF)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->else_, "ELSE", head, line, match))
+    {
+        pushStatement(source, STATEMENT_ELSE);
+    }
+    else if (matchPattern(&patterns->endif, "ENDIF", head, line, match))
+    {
+        pushStatement(source, STATEMENT_ENDIF);
+    }
+    else if (matchPattern(&patterns->switch_, "SWITCH", head, line, match))
+    {
+        pushStatement(source, STATEMENT_SWITCH)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->setswitch, "SETSWITCH", head, line, match))
+    {
+        pushStatement(source, STATEMENT_SETSWITCH)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->case_, "CASE", head, line, match))
+    {
+        pushStatement(source, STATEMENT_CASE)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->def, "DEF", head, line, match))
+    {
+        pushStatement(source, STATEMENT_DEF);
+    }
+    else if (matchPattern(&patterns->skip, "SKIP", head, line, match))
+    {
+        pushStatement(source, STATEMENT_SKIP);
+    }
+    else if (matchPattern(&patterns->endsw, "ENDSW", head, line, match))
+    {
+        pushStatement(source, STATEMENT_ENDSW);
+    }
+    else if (matchPattern(&patterns->genre, "GENRE", head, line, match))
+    {
+        pushText(source, pushStatement(source, STATEMENT_GENRE), line, match[1]);
+    }
+    else if (matchPattern(&patterns->title, "TITLE", head, line, match))
+    {
+        statement = pushStatement(source, STATEMENT_TITLE);
+        pushText(source, statement, line, match[1]);
+        if (regexec(&patterns->nestedSubtitle, source->text + statement->text, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
         {
-            chart->genre = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(chart->genre, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            chart->genre[match[1].rm_eo - match[1].rm_so] = '\0';
+            size_t title = statement->text;
+            statement->length = match[1].rm_eo;
+            statement = pushStatement(source, STATEMENT_SUBTITLE);
+            statement->text = title + match[2].rm_so;
+            statement->length = match[2].rm_eo - match[2].rm_so;
         }
-        else if (regexec(&titleRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
+    }
+    else if (matchPattern(&patterns->subtitle, "SUBTITLE", head, line, match))
+    {
+        pushText(source, pushStatement(source, STATEMENT_SUBTITLE), line, match[1]);
+    }
+    else if (matchPattern(&patterns->artist, "ARTIST", head, line, match))
+    {
+        pushText(source, pushStatement(source, STATEMENT_ARTIST), line, match[1]);
+    }
+    else if (matchPattern(&patterns->subartist, "SUBARTIST", head, line, match))
+    {
+        pushText(source, pushStatement(source, STATEMENT_SUBARTIST), line, match[1]);
+    }
+    else if (matchPattern(&patterns->stagefile, "STAGEFILE", head, line, match))
+    {
+        pushText(source, pushStatement(source, STATEMENT_STAGEFILE), line, match[1]);
+    }
+    else if (matchPattern(&patterns->banner, "BANNER", head, line, match))
+    {
+        pushText(source, pushStatement(source, STATEMENT_BANNER), line, match[1]);
+    }
+    else if (matchPattern(&patterns->playlevel, "PLAYLEVEL", head, line, match))
+    {
+        pushStatement(source, STATEMENT_PLAYLEVEL)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->difficulty, "DIFFICULTY", head, line, match))
+    {
+        pushStatement(source, STATEMENT_DIFFICULTY)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->total, "TOTAL", head, line, match))
+    {
+        pushStatement(source, STATEMENT_TOTAL)->value = captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->rank, "RANK", head, line, match))
+    {
+        pushStatement(source, STATEMENT_RANK)->key = (int)captureNumber(line, match[1]);
+    }
+    else if (matchDefinition(line, head, "WAV", match))
+    {
+        statement = pushStatement(source, STATEMENT_WAV);
+        statement->key = captureKey(line, match[1]);
+        pushText(source, statement, line, match[2]);
+    }
+    else if (matchDefinition(line, head, "BMP", match))
+    {
+        statement = pushStatement(source, STATEMENT_BMP);
+        statement->key = captureKey(line, match[1]);
+        pushText(source, statement, line, match[2]);
+    }
+    else if (matchPattern(&patterns->lnobj, "LNOBJ", head, line, match))
+    {
+        pushStatement(source, STATEMENT_LNOBJ)->key = captureKey(line, match[1]);
+    }
+    else if (matchPattern(&patterns->bpm, "BPM", head, line, match))
+    {
+        pushStatement(source, STATEMENT_BPM)->value = captureNumber(line, match[1]);
+    }
+    else if (matchPattern(&patterns->bpms, "BPM", head, line, match))
+    {
+        statement = pushStatement(source, STATEMENT_BPMS);
+        statement->key = captureKey(line, match[1]);
+        statement->value = captureNumber(line, match[2]);
+    }
+    else if (matchPattern(&patterns->stops, "STOP", head, line, match))
+    {
+        statement = pushStatement(source, STATEMENT_STOP);
+        statement->key = captureKey(line, match[1]);
+        statement->value = captureNumber(line, match[2]);
+    }
+    else if (matchPattern(&patterns->signature, "", head, line, match))
+    {
+        statement = pushStatement(source, STATEMENT_SIGNATURE);
+        statement->key = (int)captureNumber(line, match[1]);
+        statement->value = captureNumber(line, match[2]);
+    }
+    else if (matchPattern(&patterns->notes, "", head, line, match))
+    {
+        pushChannel(source, line, match);
+    }
+}
+
+static void pushRange(bms_Source *source, Statement *statement)
+{
+    if (source->ranges_size == source->ranges_capacity)
+    {
+        size_t capacity = source->ranges_capacity ? source->ranges_capacity * 2 : 4;
+        source->ranges = meterRealloc(source->meter, &source->allocator, source->ranges, sizeof(int) * source->ranges_capacity, sizeof(int) * capacity);
+        source->ranges_capacity = capacity;
+    }
+    statement->random = source->ranges_size;
+    source->ranges[source->ranges_size++] = statement->key;
+}
+
+static void pushBlock(bms_Source *source, size_t *blocks_size, BlockType type, size_t opener)
+{
+    if (*blocks_size == source->blocks_capacity)
+    {
+        size_t capacity = source->blocks_capacity ? source->blocks_capacity * 2 : 4;
+        source->blocks = meterRealloc(source->meter, &source->allocator, source->blocks, sizeof(Block) * source->blocks_capacity, sizeof(Block) * capacity);
+        source->blocks_capacity = capacity;
+    }
+    source->blocks[*blocks_size].type = type;
+    source->blocks[*blocks_size].opener = opener;
+    source->blocks[*blocks_size].last = opener;
+    (*blocks_size)++;
+}
+
+static void closeBlock(bms_Source *source, const Block *block, size_t end)
+{
+    size_t i = block->opener;
+    source->statements[block->last].jump = end;
+    while (i != end)
+    {
+        source->statements[i].end = end;
+        i = source->statements[i].jump;
+    }
+}
+
+static void linkBlocks(bms_Source *source)
+{
+    size_t blocks_size = 0;
+    size_t i, k;
+
+    for (i = 0; i < source->statements_size; i++)
+    {
+        Statement *statement = source->statements + i;
+        Block *top = blocks_size > 0 ? source->blocks + blocks_size - 1 : NULL;
+        switch (statement->type)
         {
-            chart->title = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(chart->title, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            chart->title[match[1].rm_eo - match[1].rm_so] = '\0';
-            if (regexec(&nestedSubtitleRegex, chart->title, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
+        case STATEMENT_RANDOM:
+            pushRange(source, statement);
+            break;
+        case STATEMENT_SWITCH:
+            pushRange(source, statement);
+            pushBlock(source, &blocks_size, BLOCK_SWITCH, i);
+            break;
+        case STATEMENT_SETSWITCH:
+            pushBlock(source, &blocks_size, BLOCK_SWITCH, i);
+            break;
+        case STATEMENT_IF:
+            pushBlock(source, &blocks_size, BLOCK_IF, i);
+            break;
+        case STATEMENT_ELSEIF:
+        case STATEMENT_ELSE:
+        case STATEMENT_CASE:
+        case STATEMENT_DEF:
+            if (top && top->type == (statement->type == STATEMENT_ELSEIF || statement->type == STATEMENT_ELSE ? BLOCK_IF : BLOCK_SWITCH))
             {
-                chart->subtitle = malloc(sizeof(char) * (match[2].rm_eo - match[2].rm_so + 1));
-                memcpy(chart->subtitle, chart->title + match[2].rm_so, sizeof(char) * (match[2].rm_eo - match[2].rm_so));
-                chart->subtitle[match[2].rm_eo - match[2].rm_so] = '\0';
-                chart->title[match[1].rm_eo] = '\0';
+                source->statements[top->last].jump = i;
+                top->last = i;
             }
-        }
-        else if (regexec(&subtitleRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            chart->subtitle = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(chart->subtitle, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            chart->subtitle[match[1].rm_eo - match[1].rm_so] = '\0';
-        }
-        else if (regexec(&artistRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            chart->artist = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(chart->artist, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            chart->artist[match[1].rm_eo - match[1].rm_so] = '\0';
-        }
-        else if (regexec(&subartistRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            chart->subartist = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(chart->subartist, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            chart->subartist[match[1].rm_eo - match[1].rm_so] = '\0';
-        }
-        else if (regexec(&stagefileRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            chart->stagefile = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(chart->stagefile, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            chart->stagefile[match[1].rm_eo - match[1].rm_so] = '\0';
-        }
-        else if (regexec(&bannerRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            chart->banner = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(chart->banner, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            chart->banner[match[1].rm_eo - match[1].rm_so] = '\0';
-        }
-        else if (regexec(&playlevelRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            chart->playlevel = atoi(str);
-            free(str);
-        }
-        else if (regexec(&difficultyRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            chart->difficulty = atoi(str);
-            free(str);
-        }
-        else if (regexec(&totalRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            chart->total = atof(str);
-            free(str);
-        }
-        else if (regexec(&rankRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            chart->rank = atoi(str);
-            free(str);
-        }
-        else if (regexec(&wavsRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            int a = strtol(str, NULL, 36);
-            chart->wavs[a] = malloc(sizeof(char) * (match[2].rm_eo - match[2].rm_so + 1));
-            memcpy(chart->wavs[a], line + match[2].rm_so, sizeof(char) * (match[2].rm_eo - match[2].rm_so));
-            chart->wavs[a][match[2].rm_eo - match[2].rm_so] = '\0';
-            free(str);
-        }
-        else if (regexec(&bmpsRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            int a = strtol(str, NULL, 36);
-            chart->bmps[a] = malloc(sizeof(char) * (match[2].rm_eo - match[2].rm_so + 1));
-            memcpy(chart->bmps[a], line + match[2].rm_so, sizeof(char) * (match[2].rm_eo - match[2].rm_so));
-            chart->bmps[a][match[2].rm_eo - match[2].rm_so] = '\0';
-            free(str);
-        }
-        else if (regexec(&lnobjRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            if (nb_lnobj == lnobj_length)
+            else
             {
-                nb_lnobj *= 2;
-                lnobj = realloc(lnobj, sizeof(int) * nb_lnobj);
+                statement->jump = i + 1;
+                statement->end = i + 1;
             }
-            lnobj[lnobj_length++] = strtol(str, NULL, 36);
-            free(str);
-        }
-        else if (regexec(&bpmRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            chart->sectors[0].delta = atof(str) / 240.0;
-            free(str);
-        }
-        else if (regexec(&bpmsRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            int a = strtol(str, NULL, 36);
-            free(str);
-            str = malloc(sizeof(char) * (match[2].rm_eo - match[2].rm_so + 1));
-            memcpy(str, line + match[2].rm_so, sizeof(char) * (match[2].rm_eo - match[2].rm_so));
-            str[match[2].rm_eo - match[2].rm_so] = '\0';
-            bpms[a] = atof(str);
-            free(str);
-        }
-        else if (regexec(&stopsRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            int a = strtol(str, NULL, 36);
-            free(str);
-            str = malloc(sizeof(char) * (match[2].rm_eo - match[2].rm_so + 1));
-            memcpy(str, line + match[2].rm_so, sizeof(char) * (match[2].rm_eo - match[2].rm_so));
-            str[match[2].rm_eo - match[2].rm_so] = '\0';
-            stops[a] = atoi(str) / 192.0f;
-            free(str);
-        }
-        else if (regexec(&signatureRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            int measure = atoi(str);
-            free(str);
-            str = malloc(sizeof(char) * (match[2].rm_eo - match[2].rm_so + 1));
-            memcpy(str, line + match[2].rm_so, sizeof(char) * (match[2].rm_eo - match[2].rm_so));
-            str[match[2].rm_eo - match[2].rm_so] = '\0';
-            chart->signatures[measure] = atof(str);
-            free(str);
-        }
-        else if (regexec(&signatureRegex, line, sizeof(match) / sizeof(regmatch_t), match, 0) == 0)
-        {
-            char *str = malloc(sizeof(char) * (match[1].rm_eo - match[1].rm_so + 1));
-            memcpy(str, line + match[1].rm_so, sizeof(char) * (match[1].rm_eo - match[1].rm_so));
-            str[match[1].rm_eo - match[1].rm_so] = '\0';
-            int measure = atoi(str);
-            free(str);
-            str = malloc(sizeof(char) * (match[2].rm_eo - match[2].rm_so + 1));
-            memcpy(str, line + match[2].rm_so, sizeof(char) * (match[2].rm_eo - match[2].rm_so));
-            str[match[2].rm_eo - match[2].rm_so] = '\0';
-            int channel = strtol(str, NULL, 36);
-            free(str);
-            str = malloc(sizeof(char) * (match[3].rm_eo - match[3].rm_so + 1));
-            memcpy(str, line + match[3].rm_so, sizeof(char) * (match[3].rm_eo - match[3].rm_so));
-            str[match[3].rm_eo - match[3].rm_so] = '\0';
-            size_t len = strlen(str) / 2;
-            for (i = 0; i < len; i++)
+            break;
+        case STATEMENT_ENDIF:
+            if (top && top->type == BLOCK_IF)
+            {
+                closeBlock(source, top, i);
+                blocks_size--;
+            }
+            break;
+        case STATEMENT_SKIP:
+            statement->jump = i;
+            statement->end = i + 1;
+            for (k = blocks_size; k > 0; k--)
+            {
+                if (source->blocks[k - 1].type == BLOCK_SWITCH)
+                {
+                    statement->jump = source->blocks[k - 1].opener;
+                    break;
+                }
+            }
+            break;
+        case STATEMENT_ENDSW:
+            for (k = blocks_size; k > 0; k--)
             {
-                char j[3] = {str[i * 2], str[i * 2 + 1], '\0'};
-                int key = strtol(j, NULL, 36);
-                if (key)
+                if (source->blocks[k - 1].type == BLOCK_SWITCH)
                 {
-                    size_t k;
-                    float fraction = measure + (float)i / len;
-                    switch (channel)
+                    while (blocks_size >= k)
                     {
-                    case 1:
-                        while (chart->objs_size + 1 > nb_objs)
-                        {
-                            nb_objs *= 2;
-                            chart->objs = realloc(chart->objs, nb_objs);
-                        }
-                        chart->objs[chart->objs_size].type = bms_OBJTYPE_BGM;
-                        chart->objs[chart->objs_size].fraction = fraction;
-                        chart->objs[chart->objs_size].time = 0;
-                        chart->objs[chart->objs_size].bgm.key = key;
-                        chart->objs_size++;
-                        break;
-                    case 3:
-                        while (chart->sectors_size + 1 > nb_sectors)
-                        {
-                            nb_sectors *= 2;
-                            chart->sectors = realloc(chart->sectors, nb_sectors);
-                        }
-                        chart->sectors[chart->sectors_size].fraction = fraction;
-                        chart->sectors[chart->sectors_size].time = 0;
-                        chart->sectors[chart->sectors_size].delta = strtol(j, NULL, 16) / 240.0;
-                        chart->sectors[chart->sectors_size].inclusive = 1;
-                        chart->sectors_size++;
-                        break;
-                    case 4:
-                        while (chart->objs_size + 1 > nb_objs)
-                        {
-                            nb_objs *= 2;
-                            chart->objs = realloc(chart->objs, nb_objs);
-                        }
-                        chart->objs[chart->objs_size].type = bms_OBJTYPE_BMP;
-                        chart->objs[chart->objs_size].fraction = fraction;
-                        chart->objs[chart->objs_size].time = 0;
-                        chart->objs[chart->objs_size].bmp.key = key;
-                        chart->objs[chart->objs_size].bmp.layer = 0;
-                        chart->objs_size++;
-                        break;
-                    case 6:
-                        while (chart->objs_size + 1 > nb_objs)
-                        {
-                            nb_objs *= 2;
-                            chart->objs = realloc(chart->objs, nb_objs);
-                        }
-                        chart->objs[chart->objs_size].type = bms_OBJTYPE_BMP;
-                        chart->objs[chart->objs_size].fraction = fraction;
-                        chart->objs[chart->objs_size].time = 0;
-                        chart->objs[chart->objs_size].bmp.key = key;
-                        chart->objs[chart->objs_size].bmp.layer = -1;
-                        chart->objs_size++;
-                        break;
-                    case 7:
-                        while (chart->objs_size + 1 > nb_objs)
-                        {
-                            nb_objs *= 2;
-                            chart->objs = realloc(chart->objs, nb_objs);
-                        }
-                        chart->objs[chart->objs_size].type = bms_OBJTYPE_BMP;
-                        chart->objs[chart->objs_size].fraction = fraction;
-                        chart->objs[chart->objs_size].time = 0;
-                        chart->objs[chart->objs_size].bmp.key = key;
-                        chart->objs[chart->objs_size].bmp.layer = 1;
-                        chart->objs_size++;
-                        break;
-                    case 8:
-                        while (chart->sectors_size + 1 > nb_sectors)
-                        {
-                            nb_sectors *= 2;
-                            chart->sectors = realloc(chart->sectors, nb_sectors);
-                        }
-                        chart->sectors[chart->sectors_size].fraction = fraction;
-                        chart->sectors[chart->sectors_size].time = 0;
-                        chart->sectors[chart->sectors_size].delta = bpms[key] / 240.0;
-                        chart->sectors[chart->sectors_size].inclusive = 1;
-                        chart->sectors_size++;
-                        break;
-                    case 9:
-                        while (chart->sectors_size + 2 > nb_sectors)
-                        {
-                            nb_sectors *= 2;
-                            chart->sectors = realloc(chart->sectors, nb_sectors);
-                        }
-                        chart->sectors[chart->sectors_size].fraction = fraction;
-                        chart->sectors[chart->sectors_size].time = 0;
-                        chart->sectors[chart->sectors_size].delta = 0;
-                        chart->sectors[chart->sectors_size].inclusive = 1;
-                        chart->sectors_size++;
-                        chart->sectors[chart->sectors_size].fraction = fraction;
-                        chart->sectors[chart->sectors_size].time = stops[key];
-                        chart->sectors[chart->sectors_size].delta = chart->sectors[chart->sectors_size - 2].delta;
-                        chart->sectors[chart->sectors_size].inclusive = 0;
-                        chart->sectors_size++;
-                        break;
-                    case 37:
-                    case 38:
-                    case 39:
-                    case 40:
-                    case 41:
-                    case 42:
-                    case 43:
-                    case 44:
-                    case 45:
-                    case 73:
-                    case 74:
-                    case 75:
-                    case 76:
-                    case 77:
-                    case 78:
-                    case 79:
-                    case 80:
-                    case 81:
-                        while (chart->objs_size + 1 > nb_objs)
-                        {
-                            nb_objs *= 2;
-                            chart->objs = realloc(chart->objs, nb_objs);
-                        }
-                        chart->objs[chart->objs_size].type = bms_OBJTYPE_NOTE;
-                        chart->objs[chart->objs_size].fraction = fraction;
-                        chart->objs[chart->objs_size].time = 0;
-                        chart->objs[chart->objs_size].note.player = channel / 36;
-                        chart->objs[chart->objs_size].note.line = channel % 36;
-                        chart->objs[chart->objs_size].note.key = key;
-                        chart->objs[chart->objs_size].note.end = 0;
-                        for (k = 0; k < lnobj_length; k++)
-                        {
-                            if (lnobj[k] == key)
-                            {
-                                chart->objs[chart->objs_size].note.end = 1;
-                                break;
-                            }
-                        }
-                        chart->objs_size++;
-                        break;
-                    case 109:
-                    case 110:
-                    case 111:
-                    case 112:
-                    case 113:
-                    case 114:
-                    case 115:
-                    case 116:
-                    case 117:
-                    case 145:
-                    case 146:
-                    case 147:
-                    case 148:
-                    case 149:
-                    case 150:
-                    case 151:
-                    case 152:
-                    case 153:
-                        while (chart->objs_size + 1 > nb_objs)
-                        {
-                            nb_objs *= 2;
-                            chart->objs = realloc(chart->objs, nb_objs);
-                        }
-                        chart->objs[chart->objs_size].type = bms_OBJTYPE_INVISIBLE;
-                        chart->objs[chart->objs_size].fraction = fraction;
-                        chart->objs[chart->objs_size].time = 0;
-                        chart->objs[chart->objs_size].misc.player = channel / 36 - 2;
-                        chart->objs[chart->objs_size].misc.line = channel % 36;
-                        chart->objs[chart->objs_size].misc.key = key;
-                        chart->objs_size++;
-                        break;
-                    case 181:
-                    case 182:
-                    case 183:
-                    case 184:
-                    case 185:
-                    case 186:
-                    case 187:
-                    case 188:
-                    case 189:
-                    case 217:
-                    case 218:
-                    case 219:
-                    case 220:
-                    case 221:
-                    case 222:
-                    case 223:
-                    case 224:
-                    case 225:
-                        while (chart->objs_size + 1 > nb_objs)
-                        {
-                            nb_objs *= 2;
-                            chart->objs = realloc(chart->objs, nb_objs);
-                        }
-                        chart->objs[chart->objs_size].type = bms_OBJTYPE_NOTE;
-                        chart->objs[chart->objs_size].fraction = fraction;
-                        chart->objs[chart->objs_size].time = 0;
-                        chart->objs[chart->objs_size].note.player = channel / 36 - 4;
-                        chart->objs[chart->objs_size].note.line = channel % 36;
-                        chart->objs[chart->objs_size].note.key = key;
-                        chart->objs[chart->objs_size].note.end = lnflag[(channel / 36 - 5) * 10 + channel % 36 - 1];
-                        lnflag[(channel / 36 - 5) * 10 + channel % 36 - 1] = !lnflag[(channel / 36 - 5) * 10 + channel % 36 - 1];
-                        chart->objs_size++;
-                        break;
-                    case 469:
-                    case 470:
-                    case 471:
-                    case 472:
-                    case 473:
-                    case 474:
-                    case 475:
-                    case 476:
-                    case 477:
-                    case 505:
-                    case 506:
-                    case 507:
-                    case 508:
-                    case 509:
-                    case 510:
-                    case 511:
-                    case 512:
-                    case 513:
-                        while (chart->objs_size + 1 > nb_objs)
-                        {
-                            nb_objs *= 2;
-                            chart->objs = realloc(chart->objs, nb_objs);
-                        }
-                        chart->objs[chart->objs_size].type = bms_OBJTYPE_BOMB;
-                        chart->objs[chart->objs_size].fraction = fraction;
-                        chart->objs[chart->objs_size].time = 0;
-                        chart->objs[chart->objs_size].misc.player = channel / 36 - 12;
-                        chart->objs[chart->objs_size].misc.line = channel % 36;
-                        chart->objs[chart->objs_size].misc.key = key;
-                        chart->objs_size++;
-                        break;
+                        closeBlock(source, source->blocks + blocks_size - 1, i);
+                        blocks_size--;
                     }
+                    break;
                 }
             }
-            free(str);
+            break;
+        default:
+            break;
         }
     }
-
-    free(line);
-
-    free(skip);
-    free(lnobj);
-    free(bpms);
-    free(stops);
-
-    regfree(&randomRegex);
-    regfree(&ifRegex);
-    regfree(&elseRegex);
-    regfree(&endifRegex);
-    regfree(&genreRegex);
-    regfree(&titleRegex);
-    regfree(&nestedSubtitleRegex);
-    regfree(&subtitleRegex);
-    regfree(&artistRegex);
-    regfree(&subartistRegex);
-    regfree(&stagefileRegex);
-    regfree(&bannerRegex);
-    regfree(&playlevelRegex);
-    regfree(&difficultyRegex);
-    regfree(&totalRegex);
-    regfree(&rankRegex);
-    regfree(&wavsRegex);
-    regfree(&bmpsRegex);
-    regfree(&lnobjRegex);
-    regfree(&bpmRegex);
-    regfree(&bpmsRegex);
-    regfree(&stopsRegex);
-    regfree(&signatureRegex);
-    regfree(&notesRegex);
-
-    sort(chart->sectors, chart->sectors_size, sizeof(bms_Sector), sectcomp);
-    for (i = 1; i < chart->sectors_size; i++)
-    {
-        bms_Sector *sector = chart->sectors + i;
-        bms_Sector *prev = chart->sectors + i - 1;
-        while (prev > chart->sectors && (prev->fraction < sector->fraction || prev->inclusive && prev->fraction == sector->fraction) && prev->delta > 0)
-            prev--;
-        sector->time = prev->time + (fractionDiff(chart->signatures, prev->fraction, sector->fraction) + sector->time) / prev->delta;
-    }
-
-    sort(chart->objs, chart->objs_size, sizeof(bms_Obj), objcomp);
-    for (i = 0; i < chart->objs_size; i++)
-    {
-        bms_Obj *obj = chart->objs + i;
-        bms_Sector *sector = chart->sectors + chart->sectors_size - 1;
-        while (sector > chart->sectors && (sector->fraction < obj->fraction || sector->inclusive && sector->fraction == obj->fraction))
-            sector--;
-        obj->time = sector->time + fractionDiff(chart->signatures, sector->fraction, obj->fraction) / sector->delta;
+    while (blocks_size > 0)
+    {
+        closeBlock(source, source->blocks + blocks_size - 1, source->statements_size);
+        blocks_size--;
     }
 }
 
-float bms_resolveFraction(const bms_Chart *chart, const float fraction)
+static bms_Source *allocSource(const bms_Allocator *allocator)
 {
-    return fractionDiff(chart->signatures, 0, fraction);
+    bms_Source *source = bms_allocate(allocator, NULL, 0, sizeof(bms_Source));
+    source->allocator = *allocator;
+    source->meter = NULL;
+    source->statements = NULL;
+    source->statements_size = 0;
+    source->statements_capacity = 0;
+    source->text = NULL;
+    source->text_size = 0;
+    source->text_capacity = 0;
+    source->ranges = NULL;
+    source->ranges_size = 0;
+    source->ranges_capacity = 0;
+    source->blocks = NULL;
+    source->blocks_capacity = 0;
+    return source;
 }
 
-float bms_timeToFraction(const bms_Chart *chart, const double time)
+/*
+ * Empty the source for another parse, keeping its buffers.
+ */
+static void resetSource(bms_Source *source)
+{
+    source->statements_size = 0;
+    source->text_size = 0;
+    source->ranges_size = 0;
+}
+
+static size_t sourceMemory(const bms_Source *source)
+{
+    return sizeof(Statement) * source->statements_capacity + sizeof(char) * source->text_capacity +
+           sizeof(int) * source->ranges_capacity + sizeof(Block) * source->blocks_capacity;
+}
+
+bms_Source *bms_source_alloc()
+{
+    return allocSource(bms_default_allocator());
+}
+
+void bms_source_free(bms_Source *source)
+{
+    bms_Allocator allocator = source->allocator;
+    bms_release(&allocator, source->statements, sizeof(Statement) * source->statements_capacity);
+    bms_release(&allocator, source->text, sizeof(char) * source->text_capacity);
+    bms_release(&allocator, source->ranges, sizeof(int) * source->ranges_capacity);
+    bms_release(&allocator, source->blocks, sizeof(Block) * source->blocks_capacity);
+    bms_release(&allocator, source, sizeof(bms_Source));
+}
+
+/*
+ * Size of the rest of the file, or 0 if it cannot be known (pipes, sockets, ...).
+ * Only used to report progress.
+ */
+static size_t remainingSize(FILE *input)
+{
+    long position = ftell(input);
+    long end;
+    if (position < 0 || fseek(input, 0, SEEK_END))
+        return 0;
+    end = ftell(input);
+    if (fseek(input, position, SEEK_SET) || end < position)
+        return 0;
+    return end - position;
+}
+
+static void initReader(Reader *reader, const bms_Allocator *allocator)
+{
+    reader->allocator = allocator;
+    reader->line = NULL;
+    reader->capacity = 0;
+    reader->chunk = NULL;
+}
+
+/*
+ * Opening keeps the line and chunk buffers of an earlier input.
+ */
+static void openFile(Reader *reader, FILE *input, Meter *meter)
+{
+    reader->file = input;
+    reader->data = NULL;
+    reader->size = remainingSize(input);
+    reader->position = 0;
+    if (!reader->chunk)
+        reader->chunk = meterRealloc(meter, reader->allocator, NULL, 0, READ_CHUNK);
+    reader->chunk_begin = 0;
+    reader->chunk_end = 0;
+}
+
+static void openBuffer(Reader *reader, const char *data, size_t size)
+{
+    reader->file = NULL;
+    reader->data = data;
+    reader->size = size;
+    reader->position = 0;
+    reader->chunk_begin = 0;
+    reader->chunk_end = 0;
+}
+
+static void closeReader(Reader *reader, Meter *meter)
+{
+    meterFree(meter, reader->allocator, reader->line, reader->capacity);
+    if (reader->chunk)
+        meterFree(meter, reader->allocator, reader->chunk, READ_CHUNK);
+    reader->line = NULL;
+    reader->capacity = 0;
+    reader->chunk = NULL;
+}
+
+static size_t readerMemory(const Reader *reader)
+{
+    return reader->capacity + (reader->chunk ? READ_CHUNK : 0);
+}
+
+/*
+ * Append to the line, growing it only when a line is longer than any before.
+ */
+static void appendLine(Reader *reader, size_t length, const char *data, size_t size, Meter *meter)
+{
+    if (length + size + 1 > reader->capacity)
+    {
+        size_t capacity = reader->capacity ? reader->capacity : 256;
+        while (length + size + 1 > capacity)
+            capacity *= 2;
+        reader->line = meterRealloc(meter, reader->allocator, reader->line, reader->capacity, capacity);
+        reader->capacity = capacity;
+    }
+    memcpy(reader->line + length, data, size);
+}
+
+static char *readLine(Reader *reader, Meter *meter)
+{
+    size_t length = 0;
+    if (reader->file)
+    {
+        for (;;)
+        {
+            if (reader->chunk_begin == reader->chunk_end)
+            {
+                reader->chunk_begin = 0;
+                reader->chunk_end = fread(reader->chunk, 1, READ_CHUNK, reader->file);
+                if (reader->chunk_end == 0)
+                    break;
+            }
+            const char *begin = reader->chunk + reader->chunk_begin;
+            const char *end = memchr(begin, '\n', reader->chunk_end - reader->chunk_begin);
+            size_t size = end ? (size_t)(end - begin) + 1 : reader->chunk_end - reader->chunk_begin;
+            appendLine(reader, length, begin, size, meter);
+            length += size;
+            reader->chunk_begin += size;
+            if (end)
+                break;
+        }
+        if (length == 0)
+            return NULL;
+    }
+    else
+    {
+        if (reader->position >= reader->size)
+            return NULL;
+        const char *begin = reader->data + reader->position;
+        const char *end = memchr(begin, '\n', reader->size - reader->position);
+        length = end ? (size_t)(end - begin) + 1 : reader->size - reader->position;
+        appendLine(reader, 0, begin, length, meter);
+    }
+    reader->line[length] = '\0';
+    reader->position += length;
+    if (meter)
+    {
+        meter->stats->bytes += length;
+        meter->stats->lines++;
+    }
+    return reader->line;
+}
+
+/*
+ * Read and tokenize one line.
+ * Returns 0 at the end of the input.
+ */
+static int readStatement(bms_Source *source, const Patterns *patterns, Reader *reader, Meter *meter)
+{
+    double start = meter ? now() : 0;
+    char *line = readLine(reader, meter);
+    if (!line)
+        return 0;
+    if (meter)
+        meter->stats->read_time += now() - start;
+
+    if (strrchr(line, '\r'))
+        *strrchr(line, '\r') = '\0';
+    else if (strrchr(line, '\n'))
+        *strrchr(line, '\n') = '\0';
+
+    if (meter)
+    {
+        size_t statements_size = source->statements_size;
+        start = now();
+        tokenize(source, patterns, line);
+        meter->stats->tokenize_time += now() - start;
+        if (source->statements_size == statements_size)
+            meter->stats->ignored_lines++;
+        else if (source->statements[statements_size].type <= STATEMENT_ENDSW)
+            meter->stats->control_lines++;
+        else if (source->statements[statements_size].type >= STATEMENT_SIGNATURE)
+            meter->stats->channel_lines++;
+        else
+            meter->stats->header_lines++;
+    }
+    else
+    {
+        tokenize(source, patterns, line);
+    }
+    return 1;
+}
+
+static void finishSource(bms_Source *source, Meter *meter)
+{
+    double start = meter ? now() : 0;
+    linkBlocks(source);
+    if (meter)
+        meter->stats->tokenize_time += now() - start;
+    source->meter = NULL;
+}
+
+static void parseSource(bms_Source *source, Reader *reader, Meter *meter)
+{
+    const Patterns *patterns = sharedPatterns();
+    source->meter = meter;
+    while (readStatement(source, patterns, reader, meter))
+        ;
+    finishSource(source, meter);
+}
+
+void bms_source_parse(bms_Source *source, FILE *input)
+{
+    Reader reader;
+    initReader(&reader, &source->allocator);
+    openFile(&reader, input, NULL);
+    parseSource(source, &reader, NULL);
+    closeReader(&reader, NULL);
+}
+
+void bms_source_parse_buffer(bms_Source *source, const char *data, size_t size)
+{
+    Reader reader;
+    initReader(&reader, &source->allocator);
+    openBuffer(&reader, data, size);
+    parseSource(source, &reader, NULL);
+    closeReader(&reader, NULL);
+}
+
+/*
+ * Buffers are split for parallel tokenization only in chunks of at least this size,
+ * below that starting threads costs more than it saves.
+ */
+#define PARALLEL_CHUNK (64 * 1024)
+
+/*
+ * Part of a buffer, tokenized into its own source.
+ * Every chunk but the first keeps its source and reader between parses.
+ */
+typedef struct Chunk
+{
+    bms_Source *source;
+    Reader reader;
+    const char *data;
+    size_t size;
+    Meter meter;
+    bms_ParseStats stats;
+    Meter *m;
+    pthread_t thread;
+    int started;
+} Chunk;
+
+static void tokenizeChunk(Chunk *chunk)
+{
+    const Patterns *patterns = sharedPatterns();
+    openBuffer(&chunk->reader, chunk->data, chunk->size);
+    chunk->source->meter = chunk->m;
+    while (readStatement(chunk->source, patterns, &chunk->reader, chunk->m))
+        ;
+}
+
+static void *runChunk(void *chunk)
+{
+    tokenizeChunk(chunk);
+    return NULL;
+}
+
+/*
+ * Append the statements of a later chunk, rebasing their text and random indices.
+ * Blocks are not linked yet, so jumps need no rebasing.
+ */
+static void appendSource(bms_Source *source, const bms_Source *chunk)
+{
+    size_t capacity;
+    size_t i;
+
+    capacity = source->statements_capacity ? source->statements_capacity : 64;
+    while (capacity < source->statements_size + chunk->statements_size)
+        capacity *= 2;
+    if (capacity != source->statements_capacity)
+    {
+        source->statements = meterRealloc(source->meter, &source->allocator, source->statements, sizeof(Statement) * source->statements_capacity, sizeof(Statement) * capacity);
+        source->statements_capacity = capacity;
+    }
+    capacity = source->text_capacity ? source->text_capacity : 1024;
+    while (capacity < source->text_size + chunk->text_size)
+        capacity *= 2;
+    if (capacity != source->text_capacity)
+    {
+        source->text = meterRealloc(source->meter, &source->allocator, source->text, sizeof(char) * source->text_capacity, sizeof(char) * capacity);
+        source->text_capacity = capacity;
+    }
+    capacity = source->ranges_capacity ? source->ranges_capacity : 4;
+    while (capacity < source->ranges_size + chunk->ranges_size)
+        capacity *= 2;
+    if (capacity != source->ranges_capacity)
+    {
+        source->ranges = meterRealloc(source->meter, &source->allocator, source->ranges, sizeof(int) * source->ranges_capacity, sizeof(int) * capacity);
+        source->ranges_capacity = capacity;
+    }
+
+    for (i = 0; i < chunk->statements_size; i++)
+    {
+        Statement *statement = source->statements + source->statements_size + i;
+        *statement = chunk->statements[i];
+        statement->text += source->text_size;
+        if (statement->type == STATEMENT_RANDOM || statement->type == STATEMENT_SWITCH)
+            statement->random += source->ranges_size;
+    }
+    if (chunk->text_size > 0)
+        memcpy(source->text + source->text_size, chunk->text, sizeof(char) * chunk->text_size);
+    if (chunk->ranges_size > 0)
+        memcpy(source->ranges + source->ranges_size, chunk->ranges, sizeof(int) * chunk->ranges_size);
+    source->statements_size += chunk->statements_size;
+    source->text_size += chunk->text_size;
+    source->ranges_size += chunk->ranges_size;
+}
+
+/*
+ * Tokenize a whole buffer on several threads, one chunk of lines each.
+ * The first chunk goes straight into the source on the calling thread,
+ * the others are appended in file order, so the statements are exactly those of a serial read
+ * and control flow and later definitions keep their meaning.
+ * chunks holds capacity chunks kept by the caller, grown when more threads are asked for.
+ * Returns 0 without doing anything if the buffer is too small to be worth splitting.
+ */
+static int tokenizeParallel(bms_Source *source, Chunk **chunks, unsigned int *capacity, const char *data, size_t size, unsigned int threads, Meter *meter)
+{
+    size_t begin = 0;
+    size_t memory = 0;
+    unsigned int n;
+    unsigned int k;
+
+    n = size / PARALLEL_CHUNK < threads ? (unsigned int)(size / PARALLEL_CHUNK) : threads;
+    if (n < 2)
+        return 0;
+
+    if (n > *capacity)
+    {
+        *chunks = meterRealloc(meter, &source->allocator, *chunks, sizeof(Chunk) * *capacity, sizeof(Chunk) * n);
+        for (k = *capacity; k < n; k++)
+        {
+            (*chunks)[k].source = k > 0 ? allocSource(&source->allocator) : NULL;
+            initReader(&(*chunks)[k].reader, &source->allocator);
+        }
+        *capacity = n;
+    }
+    for (k = 0; k < n; k++)
+    {
+        Chunk *chunk = *chunks + k;
+        size_t end = size * (k + 1) / n;
+        if (k + 1 < n && end > begin)
+        {
+            const char *newline = memchr(data + end - 1, '\n', size - end + 1);
+            end = newline ? (size_t)(newline - data) + 1 : size;
+        }
+        else if (end < begin)
+        {
+            end = begin;
+        }
+        chunk->data = data + begin;
+        chunk->size = end - begin;
+        chunk->started = 0;
+        begin = end;
+
+        if (k == 0)
+        {
+            chunk->m = meter;
+            continue;
+        }
+        resetSource(chunk->source);
+        chunk->m = NULL;
+        if (meter)
+        {
+            memset(&chunk->stats, 0, sizeof(bms_ParseStats));
+            chunk->meter.stats = &chunk->stats;
+            chunk->meter.memory = sourceMemory(chunk->source) + readerMemory(&chunk->reader);
+            chunk->stats.peak_memory = chunk->meter.memory;
+            chunk->m = &chunk->meter;
+        }
+        chunk->started = pthread_create(&chunk->thread, NULL, runChunk, chunk) == 0;
+    }
+
+    (*chunks)->source = source;
+    tokenizeChunk(*chunks);
+    for (k = 1; k < n; k++)
+    {
+        Chunk *chunk = *chunks + k;
+        if (chunk->started)
+            pthread_join(chunk->thread, NULL);
+        else
+            tokenizeChunk(chunk);
+        if (meter)
+        {
+            memory += chunk->stats.peak_memory;
+            chunk->stats.peak_memory = 0;
+            bms_stats_add(meter->stats, &chunk->stats);
+        }
+    }
+    if (meter && meter->memory + memory > meter->stats->peak_memory)
+        meter->stats->peak_memory = meter->memory + memory;
+
+    for (k = 1; k < n; k++)
+        appendSource(source, (*chunks)[k].source);
+    return 1;
+}
+
+/*
+ * Free the chunks kept by tokenizeParallel.
+ */
+static void freeChunks(Chunk *chunks, unsigned int capacity, const bms_Allocator *allocator)
+{
+    unsigned int k;
+    for (k = 0; k < capacity; k++)
+    {
+        closeReader(&chunks[k].reader, NULL);
+        if (k > 0)
+            bms_source_free(chunks[k].source);
+    }
+    bms_release(allocator, chunks, sizeof(Chunk) * capacity);
+}
+
+size_t bms_source_randoms(const bms_Source *source)
+{
+    return source->ranges_size;
+}
+
+int bms_source_range(const bms_Source *source, size_t random)
+{
+    return source->ranges[random];
+}
+
+size_t bms_source_variants(const bms_Source *source)
+{
+    size_t variants = 1;
+    size_t i;
+    for (i = 0; i < source->ranges_size; i++)
+    {
+        if (source->ranges[i] > 1)
+        {
+            if (variants > (size_t)-1 / source->ranges[i])
+                return (size_t)-1;
+            variants *= source->ranges[i];
+        }
+    }
+    return variants;
+}
+
+void bms_source_variant(const bms_Source *source, size_t variant, int *values)
+{
+    size_t i;
+    for (i = 0; i < source->ranges_size; i++)
+    {
+        if (source->ranges[i] > 1)
+        {
+            values[i] = variant % source->ranges[i] + 1;
+            variant /= source->ranges[i];
+        }
+        else
+        {
+            values[i] = source->ranges[i] > 0;
+        }
+    }
+}
+
+/*
+ * Move the text storage to a larger buffer, keeping every string pointing into it.
+ */
+static void growText(bms_Chart *chart, Meter *meter, size_t capacity)
+{
+    char **strings[] = {&chart->genre, &chart->title, &chart->subtitle, &chart->artist, &chart->subartist, &chart->stagefile, &chart->banner};
+    char *text = meterRealloc(meter, &chart->allocator, NULL, 0, sizeof(char) * capacity);
+    size_t i;
+    if (chart->text_size > 0)
+        memcpy(text, chart->text, sizeof(char) * chart->text_size);
+    for (i = 0; i < sizeof(strings) / sizeof(char **); i++)
+    {
+        if (*strings[i])
+            *strings[i] = text + (*strings[i] - chart->text);
+    }
+    for (i = 0; i < 1296; i++)
+    {
+        if (chart->wavs[i])
+            chart->wavs[i] = text + (chart->wavs[i] - chart->text);
+        if (chart->bmps[i])
+            chart->bmps[i] = text + (chart->bmps[i] - chart->text);
+    }
+    meterFree(meter, &chart->allocator, chart->text, sizeof(char) * chart->text_capacity);
+    chart->text = text;
+    chart->text_capacity = capacity;
+}
+
+static void assignText(const bms_Source *source, const Statement *statement, bms_Chart *chart, State *state, char **dst)
+{
+    if (chart->text_size + statement->length + 1 > chart->text_capacity)
+        growText(chart, state->meter, (chart->text_size + statement->length + 1) * 2);
+    *dst = chart->text + chart->text_size;
+    memcpy(*dst, source->text + statement->text, sizeof(char) * statement->length);
+    (*dst)[statement->length] = '\0';
+    chart->text_size += statement->length + 1;
+}
+
+/*
+ * objs and sectors are sized by presize, so pushing never grows them.
+ */
+static bms_Obj *pushObj(bms_Chart *chart, bms_Obj_Type type, float fraction)
+{
+    bms_Obj *obj = chart->objs + chart->objs_size++;
+    obj->type = type;
+    obj->fraction = fraction;
+    obj->time = 0;
+    return obj;
+}
+
+static bms_Sector *pushSector(bms_Chart *chart, float fraction, double delta)
+{
+    bms_Sector *sector = chart->sectors + chart->sectors_size++;
+    sector->fraction = fraction;
+    sector->time = 0;
+    sector->delta = delta;
+    sector->stop = 0;
+    sector->inclusive = 1;
+    return sector;
+}
+
+static void decodeChannel(const bms_Source *source, const Statement *statement, bms_Chart *chart, State *state)
+{
+    const char *str = source->text + statement->text;
+    const Channel *channel = channels + statement->channel;
+    int measure = statement->key;
+    size_t len = statement->length / 2;
+    size_t i;
+    bms_Obj *obj;
+    bms_Sector *sector;
+    unsigned char *lnflag;
+    if (channel->kind == CHANNEL_NONE)
+        return;
+    for (i = 0; i < len; i++)
+    {
+        int key = slotValue(str + i * 2, 36);
+        if (!key)
+            continue;
+        float fraction = measure + (float)i / len;
+        switch (channel->kind)
+        {
+        case CHANNEL_BGM:
+            pushObj(chart, bms_OBJTYPE_BGM, fraction)->bgm.key = key;
+            break;
+        case CHANNEL_BPM:
+            pushSector(chart, fraction, slotValue(str + i * 2, 16) / 240.0);
+            break;
+        case CHANNEL_BMP:
+            obj = pushObj(chart, bms_OBJTYPE_BMP, fraction);
+            obj->bmp.key = key;
+            obj->bmp.layer = channel->line;
+            break;
+        case CHANNEL_EXBPM:
+            if (keySetHas(state->bpms_defined, key))
+                pushSector(chart, fraction, state->bpms[key] / 240.0);
+            break;
+        case CHANNEL_STOP:
+            if (!keySetHas(state->stops_defined, key))
+                break;
+            pushSector(chart, fraction, 0);
+            sector = pushSector(chart, fraction, 0);
+            sector->stop = state->stops[key];
+            sector->inclusive = 0;
+            break;
+        default:
+            // Notes, invisible objects and bombs share player, line and key.
+            obj = pushObj(chart, channel->type, fraction);
+            obj->misc.player = channel->player;
+            obj->misc.line = channel->line;
+            obj->misc.key = key;
+            if (channel->kind == CHANNEL_NOTE)
+            {
+                obj->note.end = keySetHas(state->lnobj, key);
+                obj->note.pair = -1;
+            }
+            else if (channel->kind == CHANNEL_LONGNOTE)
+            {
+                lnflag = state->lnflag + channel->lnflag;
+                obj->note.end = *lnflag;
+                obj->note.pair = -1;
+                *lnflag = !*lnflag;
+            }
+            break;
+        }
+    }
+}
+
+/*
+ * Start at the top level, keeping the buffers of an earlier walk.
+ */
+static void openFlow(Flow *flow, const bms_Allocator *allocator, Meter *meter)
+{
+    flow->allocator = allocator;
+    flow->meter = meter;
+    if (!flow->capacity)
+    {
+        flow->capacity = 16;
+        flow->randoms = meterRealloc(meter, allocator, NULL, 0, sizeof(int) * flow->capacity);
+        flow->blocks = meterRealloc(meter, allocator, NULL, 0, sizeof(BlockType) * flow->capacity);
+    }
+    flow->depth = 0;
+    flow->randoms[0] = 0;
+}
+
+static void closeFlow(Flow *flow)
+{
+    if (!flow->capacity)
+        return;
+    meterFree(flow->meter, flow->allocator, flow->randoms, sizeof(int) * flow->capacity);
+    meterFree(flow->meter, flow->allocator, flow->blocks, sizeof(BlockType) * flow->capacity);
+    flow->capacity = 0;
+}
+
+static void pushLevel(Flow *flow, BlockType type)
+{
+    if (flow->depth + 1 == flow->capacity)
+    {
+        flow->randoms = meterRealloc(flow->meter, flow->allocator, flow->randoms, sizeof(int) * flow->capacity, sizeof(int) * flow->capacity * 2);
+        flow->blocks = meterRealloc(flow->meter, flow->allocator, flow->blocks, sizeof(BlockType) * flow->capacity, sizeof(BlockType) * flow->capacity * 2);
+        flow->capacity *= 2;
+    }
+    flow->depth++;
+    flow->randoms[flow->depth] = flow->randoms[flow->depth - 1];
+    flow->blocks[flow->depth] = type;
+}
+
+static size_t selectBranch(const bms_Source *source, size_t i, int random)
+{
+    for (;;)
+    {
+        i = source->statements[i].jump;
+        if (i >= source->statements_size)
+            return i - 1;
+        const Statement *statement = source->statements + i;
+        if (statement->type == STATEMENT_ENDIF)
+            return i - 1;
+        if (statement->type == STATEMENT_ELSE || statement->key == random)
+            return i;
+    }
+}
+
+static size_t selectCase(const bms_Source *source, size_t i, int random)
+{
+    size_t def = 0;
+    i = source->statements[i].jump;
+    while (i < source->statements_size && (source->statements[i].type == STATEMENT_CASE || source->statements[i].type == STATEMENT_DEF))
+    {
+        if (source->statements[i].type == STATEMENT_CASE && source->statements[i].key == random)
+            return i;
+        if (source->statements[i].type == STATEMENT_DEF && !def)
+            def = i;
+        i = source->statements[i].jump;
+    }
+    return def ? def : i - 1;
+}
+
+/*
+ * Execute the control statement at i.
+ * Returns the index of the last statement it consumed.
+ */
+static size_t control(const bms_Source *source, Flow *flow, const int *values, size_t i)
+{
+    const Statement *statement = source->statements + i;
+    int random;
+    size_t k;
+    switch (statement->type)
+    {
+    case STATEMENT_RANDOM:
+        flow->randoms[flow->depth] = values[statement->random];
+        break;
+    case STATEMENT_SETRANDOM:
+        flow->randoms[flow->depth] = statement->key;
+        break;
+    case STATEMENT_ENDRANDOM:
+        flow->randoms[flow->depth] = flow->depth > 0 ? flow->randoms[flow->depth - 1] : 0;
+        break;
+    case STATEMENT_IF:
+        random = flow->randoms[flow->depth];
+        pushLevel(flow, BLOCK_IF);
+        if (statement->key != random)
+            i = selectBranch(source, i, random);
+        break;
+    case STATEMENT_ELSEIF:
+    case STATEMENT_ELSE:
+        i = statement->end - 1;
+        break;
+    case STATEMENT_ENDIF:
+        if (flow->depth > 0 && flow->blocks[flow->depth] == BLOCK_IF)
+            flow->depth--;
+        break;
+    case STATEMENT_SWITCH:
+    case STATEMENT_SETSWITCH:
+        random = statement->type == STATEMENT_SWITCH ? values[statement->random] : statement->key;
+        flow->randoms[flow->depth] = random;
+        pushLevel(flow, BLOCK_SWITCH);
+        i = selectCase(source, i, random);
+        break;
+    case STATEMENT_CASE:
+    case STATEMENT_DEF:
+        break;
+    case STATEMENT_SKIP:
+        i = source->statements[statement->jump].end - 1;
+        break;
+    case STATEMENT_ENDSW:
+        for (k = flow->depth; k > 0; k--)
+        {
+            if (flow->blocks[k] == BLOCK_SWITCH)
+            {
+                flow->depth = k - 1;
+                break;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return i;
+}
+
+/*
+ * Slots of a channel 08 or 09 statement whose key is defined.
+ */
+static size_t definedSlots(const bms_Source *source, const Statement *statement, const unsigned char *defined)
+{
+    const char *str = source->text + statement->text;
+    size_t len = statement->length / 2;
+    size_t slots = 0;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        int key = slotValue(str + i * 2, 36);
+        slots += key && keySetHas(defined, key);
+    }
+    return slots;
+}
+
+/*
+ * Grow objs and sectors once to exactly fit every channel statement of the selected branches.
+ * BPM and STOP definitions are followed in order, as decodeChannel sees them.
+ * Walks the branches with the state's flow, which has to be opened again afterwards.
+ */
+static void presize(const bms_Source *source, bms_Chart *chart, State *state, const int *values)
+{
+    Flow *flow = &state->flow;
+    unsigned char bpms_defined[KEYSET_SIZE] = {0};
+    unsigned char stops_defined[KEYSET_SIZE] = {0};
+    size_t objs = chart->objs_size;
+    size_t sectors = chart->sectors_size;
+    size_t text = chart->text_size;
+    size_t i;
+
+    openFlow(flow, state->allocator, state->meter);
+    for (i = 0; i < source->statements_size; i++)
+    {
+        const Statement *statement = source->statements + i;
+        const Channel *channel = channels + statement->channel;
+        if (statement->type <= STATEMENT_ENDSW)
+            i = control(source, flow, values, i);
+        else if (statement->type == STATEMENT_BPMS)
+            keySetAdd(bpms_defined, statement->key);
+        else if (statement->type == STATEMENT_STOP)
+            keySetAdd(stops_defined, statement->key);
+        else if (statement->type == STATEMENT_CHANNEL && channel->kind == CHANNEL_EXBPM)
+            sectors += definedSlots(source, statement, bpms_defined) * channel->sectors;
+        else if (statement->type == STATEMENT_CHANNEL && channel->kind == CHANNEL_STOP)
+            sectors += definedSlots(source, statement, stops_defined) * channel->sectors;
+        else if (statement->type == STATEMENT_CHANNEL)
+        {
+            objs += statement->slots * channel->objects;
+            sectors += statement->slots * channel->sectors;
+        }
+        else if (statement->type <= STATEMENT_BANNER || statement->type == STATEMENT_WAV || statement->type == STATEMENT_BMP)
+            text += statement->length + 1;
+    }
+
+    if (objs > chart->objs_capacity)
+    {
+        chart->objs = meterRealloc(state->meter, &chart->allocator, chart->objs, sizeof(bms_Obj) * chart->objs_capacity, sizeof(bms_Obj) * objs);
+        chart->objs_capacity = objs;
+    }
+    if (sectors > chart->sectors_capacity)
+    {
+        chart->sectors = meterRealloc(state->meter, &chart->allocator, chart->sectors, sizeof(bms_Sector) * chart->sectors_capacity, sizeof(bms_Sector) * sectors);
+        chart->sectors_capacity = sectors;
+    }
+    if (text > chart->text_capacity)
+        growText(chart, state->meter, text);
+}
+
+typedef enum Phase
+{
+    PHASE_STATEMENTS,
+    PHASE_SECTOR_SORT,
+    PHASE_SECTORS,
+    PHASE_OBJECT_SORT,
+    PHASE_OBJECTS,
+    PHASE_PAIRS,
+    PHASE_LANES,
+    PHASE_DONE,
+} Phase;
+
+/*
+ * Resumable materialization.
+ * Each phase moves index forward, so a step can stop between any two units of work.
+ * last[player * 36 + line] is the last note of a lane not ended yet, while pairing.
+ * lanes[player * 36 + line] counts the playable notes of a lane while pairing,
+ * then is where the next one goes while filling the lanes.
+ * The flow and the sort scratch are kept from one materialization to the next until closeMaterializer.
+ */
+typedef struct Materializer
+{
+    const bms_Source *source;
+    bms_Chart *chart;
+    const int *values;
+    State state;
+    Phase phase;
+    size_t index;
+    size_t sector;
+    bms_Sorter sorter;
+    char *scratch;
+    size_t scratch_size;
+    int last[3 * 36];
+    size_t lanes[3 * 36];
+} Materializer;
+
+static void initMaterializer(Materializer *m, const bms_Allocator *allocator)
+{
+    m->state.allocator = allocator;
+    m->state.meter = NULL;
+    m->state.flow.capacity = 0;
+    m->scratch = NULL;
+    m->scratch_size = 0;
+}
+
+static void openMaterializer(Materializer *m, const bms_Source *source, bms_Chart *chart, const int *values, const bms_Allocator *allocator, Meter *meter)
+{
+    double start;
+
+    // Buffers kept by bms_reset are held from the start.
+    if (meter)
+        meter->memory += sizeof(bms_Obj) * chart->objs_capacity + sizeof(bms_Sector) * chart->sectors_capacity +
+                         sizeof(bms_LongNote) * chart->longnotes_capacity + sizeof(bms_LaneNote) * chart->lanes_capacity +
+                         sizeof(char) * chart->text_capacity;
+    chart->stats_valid = 0;
+    m->source = source;
+    m->chart = chart;
+    m->values = values;
+    m->state.allocator = allocator;
+    m->state.meter = meter;
+    memset(m->state.lnobj, 0, sizeof(m->state.lnobj));
+    memset(m->state.bpms_defined, 0, sizeof(m->state.bpms_defined));
+    memset(m->state.stops_defined, 0, sizeof(m->state.stops_defined));
+    memset(m->state.bpms, 0, sizeof(m->state.bpms));
+    memset(m->state.stops, 0, sizeof(m->state.stops));
+    memset(m->state.lnflag, 0, sizeof(m->state.lnflag));
+    m->phase = PHASE_STATEMENTS;
+    m->index = 0;
+
+    start = meter ? now() : 0;
+    presize(source, chart, &m->state, values);
+    if (meter)
+        meter->stats->channel_time += now() - start;
+    openFlow(&m->state.flow, allocator, meter);
+}
+
+/*
+ * Scratch for sorting size bytes, grown only when a sort needs more than any before.
+ */
+static char *sortScratch(Materializer *m, size_t size)
+{
+    if (size > m->scratch_size)
+    {
+        meterFree(m->state.meter, m->state.allocator, m->scratch, m->scratch_size);
+        m->scratch = meterRealloc(m->state.meter, m->state.allocator, NULL, 0, size);
+        m->scratch_size = size;
+    }
+    return m->scratch;
+}
+
+/*
+ * Free the flow and the sort scratch.
+ */
+static void closeMaterializer(Materializer *m)
+{
+    closeFlow(&m->state.flow);
+    meterFree(m->state.meter, m->state.allocator, m->scratch, m->scratch_size);
+    m->scratch = NULL;
+    m->scratch_size = 0;
+}
+
+static size_t materializerMemory(const Materializer *m)
+{
+    return (sizeof(int) + sizeof(BlockType)) * m->state.flow.capacity + m->scratch_size;
+}
+
+static void executeStatement(Materializer *m)
+{
+    const bms_Source *source = m->source;
+    bms_Chart *chart = m->chart;
+    State *state = &m->state;
+    const Statement *statement = source->statements + m->index;
+    size_t from = m->index;
+    double start = state->meter ? now() : 0;
+    switch (statement->type)
+    {
+    case STATEMENT_GENRE:
+        assignText(source, statement, chart, state, &chart->genre);
+        break;
+    case STATEMENT_TITLE:
+        assignText(source, statement, chart, state, &chart->title);
+        break;
+    case STATEMENT_SUBTITLE:
+        assignText(source, statement, chart, state, &chart->subtitle);
+        break;
+    case STATEMENT_ARTIST:
+        assignText(source, statement, chart, state, &chart->artist);
+        break;
+    case STATEMENT_SUBARTIST:
+        assignText(source, statement, chart, state, &chart->subartist);
+        break;
+    case STATEMENT_STAGEFILE:
+        assignText(source, statement, chart, state, &chart->stagefile);
+        break;
+    case STATEMENT_BANNER:
+        assignText(source, statement, chart, state, &chart->banner);
+        break;
+    case STATEMENT_PLAYLEVEL:
+        chart->playlevel = statement->key;
+        break;
+    case STATEMENT_DIFFICULTY:
+        chart->difficulty = statement->key;
+        break;
+    case STATEMENT_TOTAL:
+        chart->total = statement->value;
+        break;
+    case STATEMENT_RANK:
+        chart->rank = statement->key;
+        break;
+    case STATEMENT_WAV:
+        assignText(source, statement, chart, state, &chart->wavs[statement->key]);
+        break;
+    case STATEMENT_BMP:
+        assignText(source, statement, chart, state, &chart->bmps[statement->key]);
+        break;
+    case STATEMENT_LNOBJ:
+        keySetAdd(state->lnobj, statement->key);
+        break;
+    case STATEMENT_BPM:
+        chart->sectors[0].delta = statement->value / 240.0;
+        break;
+    case STATEMENT_BPMS:
+        state->bpms[statement->key] = statement->value;
+        keySetAdd(state->bpms_defined, statement->key);
+        break;
+    case STATEMENT_STOP:
+        state->stops[statement->key] = statement->value / 192.0f;
+        keySetAdd(state->stops_defined, statement->key);
+        break;
+    case STATEMENT_SIGNATURE:
+        chart->signatures[statement->key] = statement->value;
+        break;
+    case STATEMENT_CHANNEL:
+        decodeChannel(source, statement, chart, state);
+        break;
+    default:
+        m->index = control(source, &state->flow, m->values, m->index);
+        break;
+    }
+    m->index++;
+    if (state->meter)
+    {
+        if (statement->type == STATEMENT_CHANNEL)
+            state->meter->stats->channel_time += now() - start;
+        else
+            state->meter->stats->header_time += now() - start;
+        state->meter->stats->skipped_statements += m->index - from - 1;
+    }
+}
+
+static void timeSector(bms_Chart *chart, size_t i)
+{
+    bms_Sector *sector = chart->sectors + i;
+    bms_Sector *prev = sector - 1;
+    while (prev > chart->sectors && (prev->delta == 0 || prev->fraction == sector->fraction && !prev->inclusive))
+        prev--;
+    if (!sector->inclusive)
+        sector->delta = prev->delta;
+    sector->time = prev->time + (fractionDiff(chart, prev->fraction, sector->fraction) + sector->stop) / prev->delta;
+    sector->position = resolve(chart, sector->fraction);
+}
+
+/*
+ * Number of sectors sorted before a new one at fraction, which goes after those equal to it.
+ * With inclusive set, the last of them is the one objects at fraction are timed from.
+ */
+static size_t sectorBound(const bms_Chart *chart, float fraction, unsigned char inclusive)
+{
+    size_t low = 1;
+    size_t high = chart->sectors_size;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        const bms_Sector *sector = chart->sectors + mid;
+        if (sector->fraction < fraction || sector->fraction == fraction && (sector->inclusive || !inclusive))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/*
+ * Move a sector index forward to the sector an object at fraction is timed from.
+ * Objects are timed in order, so the index only ever moves forward.
+ */
+static size_t nextSector(const bms_Chart *chart, size_t sector, float fraction)
+{
+    const bms_Sector *next = chart->sectors + sector + 1;
+    while (sector + 1 < chart->sectors_size && (next->fraction < fraction || next->fraction == fraction && next->inclusive))
+    {
+        sector++;
+        next++;
+    }
+    return sector;
+}
+
+static void timeObject(bms_Chart *chart, size_t i, size_t s)
 {
-    bms_Sector *sector = chart->sectors + chart->sectors_size - 1;
-    while (sector > chart->sectors && (sector->time < time || sector->inclusive && sector->time == time))
+    bms_Obj *obj = chart->objs + i;
+    const bms_Sector *sector = chart->sectors + s;
+    obj->time = sector->delta > 0 ? sector->time + fractionDiff(chart, sector->fraction, obj->fraction) / sector->delta : sector->time;
+    obj->position = resolve(chart, obj->fraction);
+}
+
+static void pairObject(Materializer *m, size_t i)
+{
+    bms_Chart *chart = m->chart;
+    bms_Obj *obj = chart->objs + i;
+    if (obj->type != bms_OBJTYPE_NOTE || obj->note.player < 0 || obj->note.player > 2)
+        return;
+    int *lane = m->last + obj->note.player * 36 + obj->note.line;
+    if (!obj->note.end)
+    {
+        *lane = (int)i;
+        m->lanes[obj->note.player * 36 + obj->note.line]++;
+        return;
+    }
+    if (*lane < 0)
+    {
+        m->lanes[obj->note.player * 36 + obj->note.line]++;
+        return;
+    }
+    if (chart->longnotes_size == chart->longnotes_capacity)
+    {
+        size_t capacity = chart->longnotes_capacity ? chart->longnotes_capacity * 2 : 16;
+        chart->longnotes = meterRealloc(m->state.meter, &chart->allocator, chart->longnotes, sizeof(bms_LongNote) * chart->longnotes_capacity, sizeof(bms_LongNote) * capacity);
+        chart->longnotes_capacity = capacity;
+    }
+    bms_LongNote *longnote = chart->longnotes + chart->longnotes_size++;
+    longnote->start = *lane;
+    longnote->end = i;
+    longnote->duration = obj->time - chart->objs[*lane].time;
+    chart->objs[*lane].note.pair = (int)i;
+    obj->note.pair = *lane;
+    *lane = -1;
+}
+
+static void laneObject(Materializer *m, size_t i)
+{
+    bms_Chart *chart = m->chart;
+    bms_Obj *obj = chart->objs + i;
+    if (obj->type != bms_OBJTYPE_NOTE || obj->note.player < 0 || obj->note.player > 2 || obj->note.end && obj->note.pair >= 0)
+        return;
+    bms_LaneNote *note = chart->lanes + m->lanes[obj->note.player * 36 + obj->note.line]++;
+    note->time = obj->time;
+    note->obj = i;
+}
+
+/*
+ * Move on to the next phase once index reaches the end of the current one.
+ */
+static void nextPhase(Materializer *m)
+{
+    bms_Chart *chart = m->chart;
+    size_t i;
+    switch (m->phase)
+    {
+    case PHASE_STATEMENTS:
+        resolveMeasures(chart, 0);
+        bms_sorter_open(&m->sorter, chart->sectors, chart->sectors_size, sizeof(bms_Sector), sectcomp,
+                        sortScratch(m, chart->sectors_size > 1 ? sizeof(bms_Sector) * chart->sectors_size : 0));
+        break;
+    case PHASE_SECTOR_SORT:
+        chart->sectors[0].position = resolve(chart, chart->sectors[0].fraction);
+        m->index = 1;
+        break;
+    case PHASE_SECTORS:
+        bms_sorter_open(&m->sorter, chart->objs, chart->objs_size, sizeof(bms_Obj), objcomp,
+                        sortScratch(m, chart->objs_size > 1 ? sizeof(bms_Obj) * chart->objs_size : 0));
+        break;
+    case PHASE_OBJECT_SORT:
+        m->index = 0;
+        m->sector = 0;
+        break;
+    case PHASE_OBJECTS:
+        chart->longnotes_size = 0;
+        for (i = 0; i < sizeof(m->last) / sizeof(int); i++)
+        {
+            m->last[i] = -1;
+            m->lanes[i] = 0;
+        }
+        m->index = 0;
+        break;
+    case PHASE_PAIRS:
+        for (i = 0; i < sizeof(m->lanes) / sizeof(size_t); i++)
+        {
+            chart->lane_offsets[i + 1] = chart->lane_offsets[i] + m->lanes[i];
+            m->lanes[i] = chart->lane_offsets[i];
+        }
+        if (chart->lane_offsets[i] > chart->lanes_capacity)
+        {
+            chart->lanes = meterRealloc(m->state.meter, &chart->allocator, chart->lanes, sizeof(bms_LaneNote) * chart->lanes_capacity, sizeof(bms_LaneNote) * chart->lane_offsets[i]);
+            chart->lanes_capacity = chart->lane_offsets[i];
+        }
+        m->index = 0;
+        break;
+    default:
+        break;
+    }
+    m->phase++;
+}
+
+/*
+ * Work until the deadline (in now() seconds) or the end.
+ * Returns 1 once the chart is complete.
+ */
+static int stepMaterializer(Materializer *m, double deadline)
+{
+    bms_Chart *chart = m->chart;
+    Meter *meter = m->state.meter;
+    while (m->phase != PHASE_DONE)
+    {
+        double start = meter || deadline < HUGE_VAL ? now() : 0;
+        size_t end;
+        if (start >= deadline)
+            return 0;
+        switch (m->phase)
+        {
+        case PHASE_STATEMENTS:
+            end = m->index + 64;
+            while (m->index < m->source->statements_size && m->index < end)
+                executeStatement(m);
+            if (m->index >= m->source->statements_size)
+                nextPhase(m);
+            break;
+        case PHASE_SECTOR_SORT:
+            if (bms_sorter_step(&m->sorter, 4096))
+                nextPhase(m);
+            if (meter)
+                meter->stats->sector_sort_time += now() - start;
+            break;
+        case PHASE_SECTORS:
+            for (end = m->index + 1024; m->index < chart->sectors_size && m->index < end; m->index++)
+                timeSector(chart, m->index);
+            if (meter)
+                meter->stats->sector_time += now() - start;
+            if (m->index >= chart->sectors_size)
+                nextPhase(m);
+            break;
+        case PHASE_OBJECT_SORT:
+            if (bms_sorter_step(&m->sorter, 4096))
+                nextPhase(m);
+            if (meter)
+                meter->stats->object_sort_time += now() - start;
+            break;
+        case PHASE_OBJECTS:
+            for (end = m->index + 1024; m->index < chart->objs_size && m->index < end; m->index++)
+            {
+                m->sector = nextSector(chart, m->sector, chart->objs[m->index].fraction);
+                timeObject(chart, m->index, m->sector);
+            }
+            if (meter)
+                meter->stats->object_time += now() - start;
+            if (m->index >= chart->objs_size)
+                nextPhase(m);
+            break;
+        case PHASE_PAIRS:
+            for (end = m->index + 1024; m->index < chart->objs_size && m->index < end; m->index++)
+                pairObject(m, m->index);
+            if (meter)
+                meter->stats->object_time += now() - start;
+            if (m->index >= chart->objs_size)
+                nextPhase(m);
+            break;
+        case PHASE_LANES:
+            for (end = m->index + 1024; m->index < chart->objs_size && m->index < end; m->index++)
+                laneObject(m, m->index);
+            if (meter)
+                meter->stats->object_time += now() - start;
+            if (m->index >= chart->objs_size)
+                nextPhase(m);
+            break;
+        default:
+            break;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Share of the materialization done, from 0 to 1.
+ */
+static double materializerProgress(const Materializer *m)
+{
+    size_t total;
+    switch (m->phase)
+    {
+    case PHASE_STATEMENTS:
+        total = m->source->statements_size;
+        break;
+    case PHASE_SECTORS:
+        total = m->chart->sectors_size;
+        break;
+    case PHASE_OBJECTS:
+    case PHASE_PAIRS:
+    case PHASE_LANES:
+        total = m->chart->objs_size;
+        break;
+    default:
+        total = 0;
+        break;
+    }
+    return (m->phase + (total ? (double)m->index / total : 0)) / PHASE_DONE;
+}
+
+static void materialize(const bms_Source *source, bms_Chart *chart, const int *values, const bms_Allocator *allocator, Meter *meter)
+{
+    Materializer m;
+    initMaterializer(&m, allocator);
+    openMaterializer(&m, source, chart, values, allocator, meter);
+    stepMaterializer(&m, HUGE_VAL);
+    closeMaterializer(&m);
+}
+
+void bms_source_materialize(const bms_Source *source, bms_Chart *chart, const int *values)
+{
+    materialize(source, chart, values, &source->allocator, NULL);
+}
+
+void bms_parse(bms_Chart *chart, FILE *input)
+{
+    bms_parse_with(chart, input, NULL);
+}
+
+/*
+ * Temporary buffers of a parse come from the options' allocator, or the chart's one.
+ */
+static const bms_Allocator *parseAllocator(const bms_Chart *chart, const bms_ParseOptions *options)
+{
+    return options && options->allocator ? options->allocator : &chart->allocator;
+}
+
+typedef enum Stage
+{
+    STAGE_READ,
+    STAGE_MATERIALIZE,
+    STAGE_DONE,
+} Stage;
+
+/*
+ * Share of the total time spent reading and tokenizing, for progress.
+ */
+#define READ_SHARE 0.75
+
+/*
+ * A parser keeps every buffer it grows until it is destroyed.
+ * The chart keeps the first parser made with its own allocator in chart->parser
+ * and hands it out again while no other parse is using it, so parsing into the chart again
+ * does not allocate unless the input needs more room than any before.
+ */
+struct bms_Parser
+{
+    bms_Allocator allocator;
+    bms_Chart *chart;
+    Meter meter;
+    Meter *m;
+    Reader reader;
+    bms_Source *source;
+    int *values;
+    size_t values_capacity;
+    Materializer materializer;
+    Chunk *chunks;
+    unsigned int chunks_capacity;
+    Stage stage;
+    unsigned int threads;
+    int busy;
+};
+
+static bms_Parser *createParser(const bms_Allocator *allocator)
+{
+    bms_Parser *parser = bms_allocate(allocator, NULL, 0, sizeof(bms_Parser));
+    parser->allocator = *allocator;
+    initReader(&parser->reader, &parser->allocator);
+    parser->source = allocSource(&parser->allocator);
+    parser->values = NULL;
+    parser->values_capacity = 0;
+    initMaterializer(&parser->materializer, &parser->allocator);
+    parser->chunks = NULL;
+    parser->chunks_capacity = 0;
+    parser->busy = 0;
+    return parser;
+}
+
+static void destroyParser(bms_Parser *parser)
+{
+    bms_Allocator allocator = parser->allocator;
+    // Chunks allocate with the allocator of the source.
+    freeChunks(parser->chunks, parser->chunks_capacity, &allocator);
+    closeReader(&parser->reader, NULL);
+    bms_source_free(parser->source);
+    bms_release(&allocator, parser->values, sizeof(int) * parser->values_capacity);
+    closeMaterializer(&parser->materializer);
+    bms_release(&allocator, parser, sizeof(bms_Parser));
+}
+
+/*
+ * Bytes held by the buffers a parser keeps.
+ */
+static size_t parserMemory(const bms_Parser *parser)
+{
+    return readerMemory(&parser->reader) + sourceMemory(parser->source) + sizeof(int) * parser->values_capacity +
+           materializerMemory(&parser->materializer);
+}
+
+static int sameAllocator(const bms_Allocator *a, const bms_Allocator *b)
+{
+    return a->realloc == b->realloc && a->user == b->user;
+}
+
+static bms_Parser *openParser(bms_Chart *chart, const bms_ParseOptions *options)
+{
+    const bms_Allocator *allocator = parseAllocator(chart, options);
+    bms_Parser *parser = chart->parser;
+    if (!parser || parser->busy || !sameAllocator(&parser->allocator, allocator))
+    {
+        parser = createParser(allocator);
+        if (!chart->parser && sameAllocator(allocator, &chart->allocator))
+            chart->parser = parser;
+    }
+    parser->busy = 1;
+    parser->chart = chart;
+    parser->m = NULL;
+    if (options && options->stats)
+    {
+        memset(options->stats, 0, sizeof(bms_ParseStats));
+        parser->meter.stats = options->stats;
+        parser->meter.memory = parserMemory(parser);
+        parser->meter.stats->peak_memory = parser->meter.memory;
+        parser->m = &parser->meter;
+    }
+    resetSource(parser->source);
+    parser->source->meter = parser->m;
+    parser->stage = STAGE_READ;
+    parser->threads = options ? options->threads : 0;
+    return parser;
+}
+
+bms_Parser *bms_parser_alloc(bms_Chart *chart, FILE *input, const bms_ParseOptions *options)
+{
+    bms_Parser *parser = openParser(chart, options);
+    openFile(&parser->reader, input, parser->m);
+    return parser;
+}
+
+bms_Parser *bms_parser_alloc_buffer(bms_Chart *chart, const char *data, size_t size, const bms_ParseOptions *options)
+{
+    bms_Parser *parser = openParser(chart, options);
+    openBuffer(&parser->reader, data, size);
+    return parser;
+}
+
+/*
+ * Reading is done, draw the random values and start materializing.
+ */
+static void startMaterialize(bms_Parser *parser)
+{
+    bms_Source *source = parser->source;
+    size_t i;
+
+    finishSource(source, parser->m);
+
+    srand(time(NULL));
+    if (source->ranges_size + 1 > parser->values_capacity)
+    {
+        meterFree(parser->m, &parser->allocator, parser->values, sizeof(int) * parser->values_capacity);
+        parser->values_capacity = source->ranges_size + 1;
+        parser->values = meterRealloc(parser->m, &parser->allocator, NULL, 0, sizeof(int) * parser->values_capacity);
+    }
+    for (i = 0; i < source->ranges_size; i++)
+    {
+        parser->values[i] = source->ranges[i] > 0 ? rand() % source->ranges[i] + 1 : 0;
+    }
+
+    openMaterializer(&parser->materializer, source, parser->chart, parser->values, &parser->allocator, parser->m);
+    parser->stage = STAGE_MATERIALIZE;
+}
+
+static double parserProgress(const bms_Parser *parser)
+{
+    switch (parser->stage)
+    {
+    case STAGE_READ:
+        if (!parser->reader.size)
+            return 0;
+        return parser->reader.position < parser->reader.size ? READ_SHARE * parser->reader.position / parser->reader.size : READ_SHARE;
+    case STAGE_MATERIALIZE:
+        return READ_SHARE + (1 - READ_SHARE) * materializerProgress(&parser->materializer);
+    default:
+        return 1;
+    }
+}
+
+static double runParser(bms_Parser *parser, double deadline)
+{
+    unsigned int lines = 0;
+    if (parser->stage == STAGE_READ && parser->threads > 1 && !parser->reader.file && parser->reader.position == 0 &&
+        tokenizeParallel(parser->source, &parser->chunks, &parser->chunks_capacity, parser->reader.data, parser->reader.size, parser->threads, parser->m))
+    {
+        parser->reader.position = parser->reader.size;
+        startMaterialize(parser);
+    }
+    while (parser->stage == STAGE_READ)
+    {
+        if (deadline < HUGE_VAL && ++lines % 16 == 0 && now() >= deadline)
+            return parserProgress(parser);
+        if (!readStatement(parser->source, sharedPatterns(), &parser->reader, parser->m))
+            startMaterialize(parser);
+    }
+    if (parser->stage == STAGE_MATERIALIZE && stepMaterializer(&parser->materializer, deadline))
+        parser->stage = STAGE_DONE;
+    return parserProgress(parser);
+}
+
+double bms_parser_step(bms_Parser *parser, unsigned long budget_us)
+{
+    return runParser(parser, now() + budget_us * 1e-6);
+}
+
+void bms_parser_free(bms_Parser *parser)
+{
+    if (parser == parser->chart->parser)
+        parser->busy = 0;
+    else
+        destroyParser(parser);
+}
+
+void bms_parse_with(bms_Chart *chart, FILE *input, const bms_ParseOptions *options)
+{
+    bms_Parser *parser = bms_parser_alloc(chart, input, options);
+    runParser(parser, HUGE_VAL);
+    bms_parser_free(parser);
+}
+
+void bms_parse_buffer(bms_Chart *chart, const char *data, size_t size, const bms_ParseOptions *options)
+{
+    bms_Parser *parser = bms_parser_alloc_buffer(chart, data, size, options);
+    runParser(parser, HUGE_VAL);
+    bms_parser_free(parser);
+}
+
+void bms_stats_add(bms_ParseStats *total, const bms_ParseStats *stats)
+{
+    total->read_time += stats->read_time;
+    total->tokenize_time += stats->tokenize_time;
+    total->header_time += stats->header_time;
+    total->channel_time += stats->channel_time;
+    total->sector_sort_time += stats->sector_sort_time;
+    total->sector_time += stats->sector_time;
+    total->object_sort_time += stats->object_sort_time;
+    total->object_time += stats->object_time;
+    total->bytes += stats->bytes;
+    total->lines += stats->lines;
+    total->control_lines += stats->control_lines;
+    total->header_lines += stats->header_lines;
+    total->channel_lines += stats->channel_lines;
+    total->ignored_lines += stats->ignored_lines;
+    total->skipped_statements += stats->skipped_statements;
+    total->allocations += stats->allocations;
+    if (stats->peak_memory > total->peak_memory)
+        total->peak_memory = stats->peak_memory;
+}
+
+float bms_resolveFraction(const bms_Chart *chart, const float fraction)
+{
+    return resolve(chart, fraction);
+}
+
+/*
+ * Number of sectors starting at or before a time.
+ */
+static size_t countSectors(const bms_Chart *chart, double time)
+{
+    size_t low = 0;
+    size_t high = chart->sectors_size;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (chart->sectors[mid].time <= time)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/*
+ * Sector in effect at a time, given the number of sectors starting at or before it.
+ * Sectors starting at that very time apply only if inclusive.
+ */
+static const bms_Sector *sectorAt(const bms_Chart *chart, size_t count, double time)
+{
+    const bms_Sector *sector = chart->sectors + (count ? count - 1 : 0);
+    while (sector > chart->sectors && sector->time == time && !sector->inclusive)
         sector--;
-    return bms_resolveFraction(chart, sector->fraction) + (time - sector->time) * sector->delta;
-}
\ No newline at end of file
+    return sector;
+}
+
+float bms_timeToFraction(const bms_Chart *chart, const double time)
+{
+    const bms_Sector *sector = sectorAt(chart, countSectors(chart, time), time);
+    return sector->position + (time - sector->time) * sector->delta;
+}
+
+void bms_timesToFractions(const bms_Chart *chart, const double *times, float *fractions, size_t size)
+{
+    size_t count = 0;
+    size_t i;
+    for (i = 0; i < size; i++)
+    {
+        double time = times[i];
+        // Ascending times sweep the sectors once, anything else falls back to a search.
+        if (i > 0 && time < times[i - 1])
+            count = countSectors(chart, time);
+        while (count < chart->sectors_size && chart->sectors[count].time <= time)
+            count++;
+        const bms_Sector *sector = sectorAt(chart, count, time);
+        fractions[i] = sector->position + (time - sector->time) * sector->delta;
+    }
+}
+
+void bms_resolveFractions(const bms_Chart *chart, const float *fractions, float *positions, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++)
+    {
+        positions[i] = resolve(chart, fractions[i]);
+    }
+}
+
+const bms_LaneNote *bms_lane_notes(const bms_Chart *chart, int player, int line, size_t *size)
+{
+    int lane = player * 36 + line;
+    if (player < 0 || player > 2 || line < 0 || line >= 36)
+    {
+        *size = 0;
+        return chart->lanes;
+    }
+    *size = chart->lane_offsets[lane + 1] - chart->lane_offsets[lane];
+    return chart->lanes + chart->lane_offsets[lane];
+}
+
+long bms_nearest_note(const bms_Chart *chart, int player, int line, double time, double window)
+{
+    size_t size;
+    const bms_LaneNote *notes = bms_lane_notes(chart, player, line, &size);
+    size_t low = 0;
+    size_t high = size;
+    long nearest = -1;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (notes[mid].time < time)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    // Only the notes right before and at or after the time can be the nearest.
+    if (low > 0 && time - notes[low - 1].time <= window)
+    {
+        nearest = (long)notes[low - 1].obj;
+        window = time - notes[low - 1].time;
+    }
+    if (low < size && notes[low].time - time <= window && (nearest < 0 || notes[low].time - time < window))
+        nearest = (long)notes[low].obj;
+    return nearest;
+}
+
+/*
+ * Recompute times after an edit, from a sector and from the objects at or after a fraction.
+ * Times before them do not depend on the edit, so the work is proportional to what comes after it.
+ */
+static void retime(bms_Chart *chart, size_t from, float fraction)
+{
+    size_t low = 0;
+    size_t high = chart->objs_size;
+    size_t i;
+    for (i = from > 1 ? from : 1; i < chart->sectors_size; i++)
+        timeSector(chart, i);
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (chart->objs[mid].fraction < fraction)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    size_t first = low;
+    if (first < chart->objs_size)
+    {
+        size_t sector = sectorBound(chart, chart->objs[first].fraction, 1) - 1;
+        for (i = first; i < chart->objs_size; i++)
+        {
+            sector = nextSector(chart, sector, chart->objs[i].fraction);
+            timeObject(chart, i, sector);
+        }
+    }
+
+    // Long notes are paired in object order, so they are ordered by end.
+    low = 0;
+    high = chart->longnotes_size;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (chart->longnotes[mid].end < first)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    for (i = low; i < chart->longnotes_size; i++)
+    {
+        bms_LongNote *longnote = chart->longnotes + i;
+        longnote->duration = chart->objs[longnote->end].time - chart->objs[longnote->start].time;
+    }
+
+    for (i = 0; i < 3 * 36; i++)
+    {
+        size_t end = chart->lane_offsets[i + 1];
+        low = chart->lane_offsets[i];
+        high = end;
+        while (low < high)
+        {
+            size_t mid = low + (high - low) / 2;
+            if (chart->lanes[mid].obj < first)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        for (; low < end; low++)
+            chart->lanes[low].time = chart->objs[chart->lanes[low].obj].time;
+    }
+    chart->stats_valid = 0;
+}
+
+/*
+ * Insert a sector at its sorted place, after the sectors equal to it.
+ */
+static size_t insertSector(bms_Chart *chart, float fraction, double delta, double stop, unsigned char inclusive)
+{
+    size_t index = sectorBound(chart, fraction, inclusive);
+    if (chart->sectors_size == chart->sectors_capacity)
+    {
+        size_t capacity = chart->sectors_capacity ? chart->sectors_capacity * 2 : 16;
+        chart->sectors = bms_allocate(&chart->allocator, chart->sectors, sizeof(bms_Sector) * chart->sectors_capacity, sizeof(bms_Sector) * capacity);
+        chart->sectors_capacity = capacity;
+    }
+    memmove(chart->sectors + index + 1, chart->sectors + index, sizeof(bms_Sector) * (chart->sectors_size - index));
+    chart->sectors_size++;
+    bms_Sector *sector = chart->sectors + index;
+    sector->fraction = fraction;
+    sector->position = 0;
+    sector->time = 0;
+    sector->delta = delta;
+    sector->stop = stop;
+    sector->inclusive = inclusive;
+    return index;
+}
+
+size_t bms_insert_tempo(bms_Chart *chart, float fraction, double delta)
+{
+    if (!(fraction >= 0 && fraction < 1000) || !(delta > 0))
+        return 0;
+    size_t index = insertSector(chart, fraction, delta, 0, 1);
+    retime(chart, index, fraction);
+    return index;
+}
+
+size_t bms_insert_stop(bms_Chart *chart, float fraction, double length)
+{
+    if (!(fraction >= 0 && fraction < 1000) || !(length >= 0))
+        return 0;
+    size_t start = insertSector(chart, fraction, 0, 0, 1);
+    size_t index = insertSector(chart, fraction, 0, length, 0);
+    retime(chart, start, fraction);
+    return index;
+}
+
+/*
+ * Other sector of the stop a sector is part of, or 0 if it is not part of one.
+ * At a fraction, the n-th inclusive sector of delta 0 starts the stop ending at the n-th non-inclusive one,
+ * as the writer pairs them; the initial sector is never part of a stop.
+ */
+static size_t stopPartner(const bms_Chart *chart, size_t index)
+{
+    const bms_Sector *sectors = chart->sectors;
+    float fraction = sectors[index].fraction;
+    unsigned char start = sectors[index].inclusive;
+    size_t first = index;
+    size_t end = index + 1;
+    size_t rank = 0;
+    size_t i;
+    if (index == 0 || start && sectors[index].delta != 0)
+        return 0;
+    while (first > 1 && sectors[first - 1].fraction == fraction)
+        first--;
+    while (end < chart->sectors_size && sectors[end].fraction == fraction)
+        end++;
+    for (i = first; i < index; i++)
+        rank += start ? sectors[i].inclusive && sectors[i].delta == 0 : !sectors[i].inclusive;
+    for (i = first; i < end; i++)
+    {
+        if ((start ? !sectors[i].inclusive : sectors[i].inclusive && sectors[i].delta == 0) && rank-- == 0)
+            return i;
+    }
+    return 0;
+}
+
+static void eraseSector(bms_Chart *chart, size_t index)
+{
+    chart->sectors_size--;
+    memmove(chart->sectors + index, chart->sectors + index + 1, sizeof(bms_Sector) * (chart->sectors_size - index));
+}
+
+int bms_remove_sector(bms_Chart *chart, size_t index)
+{
+    if (index == 0 || index >= chart->sectors_size)
+        return 0;
+    size_t partner = stopPartner(chart, index);
+    float fraction = chart->sectors[index].fraction;
+    // The later sector goes first, so the index of the earlier one still holds.
+    eraseSector(chart, partner > index ? partner : index);
+    if (partner)
+        eraseSector(chart, partner > index ? index : partner);
+    retime(chart, partner && partner < index ? partner : index, fraction);
+    return 1;
+}
+
+int bms_set_tempo(bms_Chart *chart, size_t index, double delta)
+{
+    if (index >= chart->sectors_size || !chart->sectors[index].inclusive || !(delta > 0) || stopPartner(chart, index))
+        return 0;
+    chart->sectors[index].delta = delta;
+    retime(chart, index, chart->sectors[index].fraction);
+    return 1;
+}
+
+int bms_set_stop(bms_Chart *chart, size_t index, double length)
+{
+    if (index >= chart->sectors_size || chart->sectors[index].inclusive || !(length >= 0))
+        return 0;
+    chart->sectors[index].stop = length;
+    retime(chart, index, chart->sectors[index].fraction);
+    return 1;
+}
+
+int bms_set_signature(bms_Chart *chart, int measure, float signature)
+{
+    if (measure < 0 || measure >= 1000 || !(signature > 0))
+        return 0;
+    chart->signatures[measure] = signature;
+    resolveMeasures(chart, measure);
+    retime(chart, sectorBound(chart, (float)measure, 1), (float)measure);
+    return 1;
+}
@@ -0,0 +1,167 @@
+#ifndef __BMSPARSER_CHANNELS_H__
+#define __BMSPARSER_CHANNELS_H__
+
+#include <bmsparser.h>
+
+/*
+ * What a channel decodes to.
+ */
+typedef enum ChannelKind
+{
+    CHANNEL_NONE,
+    CHANNEL_BGM,
+    CHANNEL_BPM,
+    CHANNEL_BMP,
+    CHANNEL_EXBPM,
+    CHANNEL_STOP,
+    CHANNEL_NOTE,
+    CHANNEL_INVISIBLE,
+    CHANNEL_LONGNOTE,
+    CHANNEL_BOMB,
+} ChannelKind;
+
+/*
+ * Channel descriptor.
+ * line is the BMP layer for BMP channels.
+ * lnflag is the index into the long note toggles for long note channels.
+ * objects and sectors are pushed per non-00 slot.
+ */
+typedef struct Channel
+{
+    unsigned char kind;
+    unsigned char type;
+    signed char player;
+    signed char line;
+    unsigned char lnflag;
+    unsigned char objects;
+    unsigned char sectors;
+} Channel;
+
+/*
+ * Every channel 00 ~ ZZ, by base-36 value; unlisted channels decode to nothing.
+ */
+static const Channel channels[1296] = {
+    [1] = {CHANNEL_BGM, bms_OBJTYPE_BGM, 0, 0, 0, 1, 0}, // 01
+    [3] = {CHANNEL_BPM, 0, 0, 0, 0, 0, 1}, // 03
+    [4] = {CHANNEL_BMP, bms_OBJTYPE_BMP, 0, 0, 0, 1, 0}, // 04
+    [6] = {CHANNEL_BMP, bms_OBJTYPE_BMP, 0, -1, 0, 1, 0}, // 06
+    [7] = {CHANNEL_BMP, bms_OBJTYPE_BMP, 0, 1, 0, 1, 0}, // 07
+    [8] = {CHANNEL_EXBPM, 0, 0, 0, 0, 0, 1}, // 08
+    [9] = {CHANNEL_STOP, 0, 0, 0, 0, 0, 2}, // 09
+    [37] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 1, 1, 0, 1, 0}, // 11
+    [38] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 1, 2, 0, 1, 0}, // 12
+    [39] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 1, 3, 0, 1, 0}, // 13
+    [40] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 1, 4, 0, 1, 0}, // 14
+    [41] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 1, 5, 0, 1, 0}, // 15
+    [42] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 1, 6, 0, 1, 0}, // 16
+    [43] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 1, 7, 0, 1, 0}, // 17
+    [44] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 1, 8, 0, 1, 0}, // 18
+    [45] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 1, 9, 0, 1, 0}, // 19
+    [73] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 2, 1, 0, 1, 0}, // 21
+    [74] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 2, 2, 0, 1, 0}, // 22
+    [75] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 2, 3, 0, 1, 0}, // 23
+    [76] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 2, 4, 0, 1, 0}, // 24
+    [77] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 2, 5, 0, 1, 0}, // 25
+    [78] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 2, 6, 0, 1, 0}, // 26
+    [79] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 2, 7, 0, 1, 0}, // 27
+    [80] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 2, 8, 0, 1, 0}, // 28
+    [81] = {CHANNEL_NOTE, bms_OBJTYPE_NOTE, 2, 9, 0, 1, 0}, // 29
+    [109] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 1, 1, 0, 1, 0}, // 31
+    [110] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 1, 2, 0, 1, 0}, // 32
+    [111] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 1, 3, 0, 1, 0}, // 33
+    [112] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 1, 4, 0, 1, 0}, // 34
+    [113] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 1, 5, 0, 1, 0}, // 35
+    [114] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 1, 6, 0, 1, 0}, // 36
+    [115] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 1, 7, 0, 1, 0}, // 37
+    [116] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 1, 8, 0, 1, 0}, // 38
+    [117] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 1, 9, 0, 1, 0}, // 39
+    [145] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 2, 1, 0, 1, 0}, // 41
+    [146] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 2, 2, 0, 1, 0}, // 42
+    [147] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 2, 3, 0, 1, 0}, // 43
+    [148] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 2, 4, 0, 1, 0}, // 44
+    [149] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 2, 5, 0, 1, 0}, // 45
+    [150] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 2, 6, 0, 1, 0}, // 46
+    [151] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 2, 7, 0, 1, 0}, // 47
+    [152] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 2, 8, 0, 1, 0}, // 48
+    [153] = {CHANNEL_INVISIBLE, bms_OBJTYPE_INVISIBLE, 2, 9, 0, 1, 0}, // 49
+    [181] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 1, 1, 0, 1, 0}, // 51
+    [182] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 1, 2, 1, 1, 0}, // 52
+    [183] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 1, 3, 2, 1, 0}, // 53
+    [184] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 1, 4, 3, 1, 0}, // 54
+    [185] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 1, 5, 4, 1, 0}, // 55
+    [186] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 1, 6, 5, 1, 0}, // 56
+    [187] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 1, 7, 6, 1, 0}, // 57
+    [188] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 1, 8, 7, 1, 0}, // 58
+    [189] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 1, 9, 8, 1, 0}, // 59
+    [217] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 2, 1, 10, 1, 0}, // 61
+    [218] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 2, 2, 11, 1, 0}, // 62
+    [219] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 2, 3, 12, 1, 0}, // 63
+    [220] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 2, 4, 13, 1, 0}, // 64
+    [221] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 2, 5, 14, 1, 0}, // 65
+    [222] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 2, 6, 15, 1, 0}, // 66
+    [223] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 2, 7, 16, 1, 0}, // 67
+    [224] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 2, 8, 17, 1, 0}, // 68
+    [225] = {CHANNEL_LONGNOTE, bms_OBJTYPE_NOTE, 2, 9, 18, 1, 0}, // 69
+    [469] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 1, 1, 0, 1, 0}, // D1
+    [470] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 1, 2, 0, 1, 0}, // D2
+    [471] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 1, 3, 0, 1, 0}, // D3
+    [472] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 1, 4, 0, 1, 0}, // D4
+    [473] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 1, 5, 0, 1, 0}, // D5
+    [474] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 1, 6, 0, 1, 0}, // D6
+    [475] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 1, 7, 0, 1, 0}, // D7
+    [476] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 1, 8, 0, 1, 0}, // D8
+    [477] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 1, 9, 0, 1, 0}, // D9
+    [505] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 2, 1, 0, 1, 0}, // E1
+    [506] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 2, 2, 0, 1, 0}, // E2
+    [507] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 2, 3, 0, 1, 0}, // E3
+    [508] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 2, 4, 0, 1, 0}, // E4
+    [509] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 2, 5, 0, 1, 0}, // E5
+    [510] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 2, 6, 0, 1, 0}, // E6
+    [511] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 2, 7, 0, 1, 0}, // E7
+    [512] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 2, 8, 0, 1, 0}, // E8
+    [513] = {CHANNEL_BOMB, bms_OBJTYPE_BOMB, 2, 9, 0, 1, 0}, // E9
+};
+
+/*
+ * Base-36 digit value + 1 of every character, 0 if it is not a digit.
+ */
+static const unsigned char digits[256] = {
+    ['0'] = 1,
+    ['1'] = 2,
+    ['2'] = 3,
+    ['3'] = 4,
+    ['4'] = 5,
+    ['5'] = 6,
+    ['6'] = 7,
+    ['7'] = 8,
+    ['8'] = 9,
+    ['9'] = 10,
+    ['A'] = 11, ['a'] = 11,
+    ['B'] = 12, ['b'] = 12,
+    ['C'] = 13, ['c'] = 13,
+    ['D'] = 14, ['d'] = 14,
+    ['E'] = 15, ['e'] = 15,
+    ['F'] = 16, ['f'] = 16,
+    ['G'] = 17, ['g'] = 17,
+    ['H'] = 18, ['h'] = 18,
+    ['I'] = 19, ['i'] = 19,
+    ['J'] = 20, ['j'] = 20,
+    ['K'] = 21, ['k'] = 21,
+    ['L'] = 22, ['l'] = 22,
+    ['M'] = 23, ['m'] = 23,
+    ['N'] = 24, ['n'] = 24,
+    ['O'] = 25, ['o'] = 25,
+    ['P'] = 26, ['p'] = 26,
+    ['Q'] = 27, ['q'] = 27,
+    ['R'] = 28, ['r'] = 28,
+    ['S'] = 29, ['s'] = 29,
+    ['T'] = 30, ['t'] = 30,
+    ['U'] = 31, ['u'] = 31,
+    ['V'] = 32, ['v'] = 32,
+    ['W'] = 33, ['w'] = 33,
+    ['X'] = 34, ['x'] = 34,
+    ['Y'] = 35, ['y'] = 35,
+    ['Z'] = 36, ['z'] = 36,
+};
+
+#endif
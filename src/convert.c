@@ -1,5 +1,4 @@
 #include <bmsparser/convert.h>
-#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
@@ -7,15 +6,10 @@
 
 void bms_sjis_to_utf8(const char *src, char *dst)
 {
-    size_t i;
-    char *output = malloc(3 * strlen(src));
-    for (i = 0; i < 3 * strlen(src); i++)
-    {
-        output[i] = ' ';
-    }
+    size_t length = strlen(src);
     size_t indexSrc = 0, indexDst = 0;
 
-    while (indexSrc < strlen(src))
+    while (indexSrc < length)
     {
         char arraySection = ((uint8_t)src[indexSrc]) >> 4;
 
@@ -33,7 +27,7 @@ void bms_sjis_to_utf8(const char *src, char *dst)
         {
             arrayOffset += (((uint8_t)src[indexSrc]) & 0xf) << 8;
             indexSrc++;
-            if (indexSrc >= strlen(src))
+            if (indexSrc >= length)
                 break;
         }
         arrayOffset += (uint8_t)src[indexSrc++];
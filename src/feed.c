@@ -0,0 +1,110 @@
+#include <bmsparser/feed.h>
+#include <stdatomic.h>
+#include "allocator.h"
+
+// Indices are kept on separate cache lines so the two threads do not share one.
+struct bms_Feed
+{
+    atomic_size_t head;
+    char head_padding[64 - sizeof(atomic_size_t)];
+    atomic_size_t tail;
+    char tail_padding[64 - sizeof(atomic_size_t)];
+    bms_Allocator allocator;
+    bms_Obj *events;
+    size_t mask;
+    const bms_Obj *const *pending[bms_QUEUE_COUNT];
+    size_t pending_size[bms_QUEUE_COUNT];
+};
+
+bms_Feed *bms_feed_alloc(size_t capacity)
+{
+    size_t size = 1;
+    bms_Feed *feed = bms_allocate(bms_default_allocator(), NULL, 0, sizeof(bms_Feed));
+    int q;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    atomic_init(&feed->head, 0);
+    atomic_init(&feed->tail, 0);
+    feed->allocator = *bms_default_allocator();
+    feed->events = bms_allocate(&feed->allocator, NULL, 0, sizeof(bms_Obj) * size);
+    feed->mask = size - 1;
+    for (q = 0; q < bms_QUEUE_COUNT; q++)
+    {
+        feed->pending[q] = NULL;
+        feed->pending_size[q] = 0;
+    }
+    return feed;
+}
+
+void bms_feed_free(bms_Feed *feed)
+{
+    bms_Allocator allocator = feed->allocator;
+    bms_release(&allocator, feed->events, sizeof(bms_Obj) * (feed->mask + 1));
+    bms_release(&allocator, feed, sizeof(bms_Feed));
+}
+
+size_t bms_feed_fill(bms_Feed *feed, bms_Scheduler *scheduler, unsigned int queues, double time)
+{
+    size_t head = atomic_load_explicit(&feed->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&feed->tail, memory_order_acquire);
+    size_t pushed = 0;
+    int q;
+
+    // Every queue is popped up to the same time, so merging them keeps the feed in time order.
+    // A pop continues right after the previous one, so it extends what is still pending.
+    for (q = 0; q < bms_QUEUE_COUNT; q++)
+    {
+        const bms_Obj *const *events;
+        size_t popped;
+        if (!(queues >> q & 1))
+            continue;
+        popped = bms_scheduler_pop(scheduler, q, time, &events);
+        if (!feed->pending_size[q])
+            feed->pending[q] = events;
+        feed->pending_size[q] += popped;
+    }
+    while (head - tail <= feed->mask)
+    {
+        int next = -1;
+        for (q = 0; q < bms_QUEUE_COUNT; q++)
+        {
+            if ((queues >> q & 1) && feed->pending_size[q] &&
+                (next < 0 || feed->pending[q][0]->time < feed->pending[next][0]->time))
+                next = q;
+        }
+        if (next < 0)
+            break;
+        feed->events[head & feed->mask] = *feed->pending[next][0];
+        feed->pending[next]++;
+        feed->pending_size[next]--;
+        head++;
+        pushed++;
+    }
+    atomic_store_explicit(&feed->head, head, memory_order_release);
+    return pushed;
+}
+
+void bms_feed_discard(bms_Feed *feed)
+{
+    int q;
+    for (q = 0; q < bms_QUEUE_COUNT; q++)
+    {
+        feed->pending_size[q] = 0;
+    }
+}
+
+size_t bms_feed_drain(bms_Feed *feed, double time, bms_Obj *events, size_t capacity)
+{
+    size_t tail = atomic_load_explicit(&feed->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&feed->head, memory_order_acquire);
+    size_t popped = 0;
+    while (tail != head && popped < capacity && feed->events[tail & feed->mask].time < time)
+    {
+        events[popped++] = feed->events[tail & feed->mask];
+        tail++;
+    }
+    atomic_store_explicit(&feed->tail, tail, memory_order_release);
+    return popped;
+}
@@ -0,0 +1,115 @@
+#include <bmsparser/scheduler.h>
+#include <math.h>
+#include "allocator.h"
+
+struct bms_Scheduler
+{
+    bms_Allocator allocator;
+    const bms_Obj **events;
+    size_t begin[bms_QUEUE_COUNT];
+    size_t end[bms_QUEUE_COUNT];
+    size_t cursor[bms_QUEUE_COUNT];
+};
+
+static unsigned char queueMask(const bms_Obj *obj)
+{
+    switch (obj->type)
+    {
+    case bms_OBJTYPE_BGM:
+        return 1 << bms_QUEUE_BGM;
+    case bms_OBJTYPE_BMP:
+        return 1 << bms_QUEUE_BGA;
+    case bms_OBJTYPE_NOTE:
+        return 1 << bms_QUEUE_KEYSOUND | 1 << bms_QUEUE_JUDGE;
+    case bms_OBJTYPE_BOMB:
+        return 1 << bms_QUEUE_JUDGE;
+    default:
+        return 0;
+    }
+}
+
+bms_Scheduler *bms_scheduler_alloc(const bms_Chart *chart)
+{
+    size_t counts[bms_QUEUE_COUNT] = {0};
+    size_t total = 0;
+    size_t i;
+    int q;
+    bms_Scheduler *scheduler = bms_allocate(&chart->allocator, NULL, 0, sizeof(bms_Scheduler));
+    scheduler->allocator = chart->allocator;
+
+    for (i = 0; i < chart->objs_size; i++)
+    {
+        unsigned char mask = queueMask(chart->objs + i);
+        for (q = 0; q < bms_QUEUE_COUNT; q++)
+        {
+            counts[q] += mask >> q & 1;
+        }
+    }
+    for (q = 0; q < bms_QUEUE_COUNT; q++)
+    {
+        scheduler->begin[q] = total;
+        scheduler->end[q] = total;
+        scheduler->cursor[q] = total;
+        total += counts[q];
+    }
+
+    // Objects are sorted by fraction, and time never decreases along fractions,
+    // so each queue comes out in time order.
+    scheduler->events = bms_allocate(&scheduler->allocator, NULL, 0, sizeof(bms_Obj *) * (total + 1));
+    for (i = 0; i < chart->objs_size; i++)
+    {
+        unsigned char mask = queueMask(chart->objs + i);
+        for (q = 0; q < bms_QUEUE_COUNT; q++)
+        {
+            if (mask >> q & 1)
+                scheduler->events[scheduler->end[q]++] = chart->objs + i;
+        }
+    }
+    return scheduler;
+}
+
+void bms_scheduler_free(bms_Scheduler *scheduler)
+{
+    bms_Allocator allocator = scheduler->allocator;
+    size_t total = scheduler->end[bms_QUEUE_COUNT - 1];
+    bms_release(&allocator, scheduler->events, sizeof(bms_Obj *) * (total + 1));
+    bms_release(&allocator, scheduler, sizeof(bms_Scheduler));
+}
+
+size_t bms_scheduler_pop(bms_Scheduler *scheduler, bms_Queue queue, double time, const bms_Obj *const **events)
+{
+    size_t start = scheduler->cursor[queue];
+    size_t i = start;
+    while (i < scheduler->end[queue] && scheduler->events[i]->time < time)
+    {
+        i++;
+    }
+    scheduler->cursor[queue] = i;
+    *events = scheduler->events + start;
+    return i - start;
+}
+
+double bms_scheduler_peek(const bms_Scheduler *scheduler, bms_Queue queue)
+{
+    size_t i = scheduler->cursor[queue];
+    return i < scheduler->end[queue] ? scheduler->events[i]->time : HUGE_VAL;
+}
+
+void bms_scheduler_seek(bms_Scheduler *scheduler, double time)
+{
+    int q;
+    for (q = 0; q < bms_QUEUE_COUNT; q++)
+    {
+        size_t low = scheduler->begin[q];
+        size_t high = scheduler->end[q];
+        while (low < high)
+        {
+            size_t mid = low + (high - low) / 2;
+            if (scheduler->events[mid]->time < time)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        scheduler->cursor[q] = low;
+    }
+}
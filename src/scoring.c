@@ -0,0 +1,49 @@
+#include <bmsparser/scoring.h>
+
+/*
+ * LR2 judge windows in milliseconds, Perfect Great ~ Bad, per rank.
+ */
+static const double windows[bms_RANK_EASY + 1][bms_JUDGE_BAD + 1] = {
+    {8, 24, 40, 200},
+    {15, 30, 60, 200},
+    {18, 40, 100, 200},
+    {21, 60, 120, 200},
+};
+
+void bms_scoring_profile(bms_Chart *chart, bms_ScoringProfile *profile)
+{
+    double gain;
+    int rank;
+    int judge;
+
+    profile->notes = bms_compute_stats(chart)->notes;
+    profile->rank = chart->rank >= bms_RANK_VERYHARD && chart->rank <= bms_RANK_EASY ? chart->rank : bms_RANK_NORMAL;
+    for (rank = bms_RANK_VERYHARD; rank <= bms_RANK_EASY; rank++)
+    {
+        for (judge = bms_JUDGE_PGREAT; judge <= bms_JUDGE_BAD; judge++)
+        {
+            profile->windows[rank][judge] = windows[rank][judge] / 1000;
+        }
+    }
+
+    gain = profile->notes ? chart->total / profile->notes : 0;
+    profile->gauge[bms_JUDGE_PGREAT] = gain;
+    profile->gauge[bms_JUDGE_GREAT] = gain;
+    profile->gauge[bms_JUDGE_GOOD] = gain / 2;
+    profile->gauge[bms_JUDGE_BAD] = -4;
+    profile->gauge[bms_JUDGE_POOR] = -6;
+    profile->gauge[bms_JUDGE_EMPTY_POOR] = -2;
+}
+
+bms_Judge bms_scoring_judge(const bms_ScoringProfile *profile, double offset)
+{
+    const double *row = profile->windows[profile->rank];
+    double distance = offset < 0 ? -offset : offset;
+    int judge;
+    for (judge = bms_JUDGE_PGREAT; judge <= bms_JUDGE_BAD; judge++)
+    {
+        if (distance <= row[judge])
+            return judge;
+    }
+    return bms_JUDGE_EMPTY_POOR;
+}
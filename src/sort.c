@@ -1,51 +1,74 @@
 #include "sort.h"
-#include <stdlib.h>
+#include "allocator.h"
+#include <stdint.h>
 #include <string.h>
 
-static void merge(void *arr, size_t n1, size_t n2, size_t item, bms_Less less)
+void bms_sorter_open(bms_Sorter *sorter, void *arr, size_t n, size_t item, bms_Less less, void *tmp)
 {
-    void *mid = (char *)arr + item * n1;
-    void *end = (char *)mid + item * n2;
-    void *a = arr;
-    void *b = mid;
-    void *tmp = malloc(item * (n1 + n2));
-    void *c = tmp;
-    while (a < mid && b < end)
+    sorter->arr = arr;
+    sorter->n = n;
+    sorter->item = item;
+    sorter->less = less;
+    sorter->tmp = tmp;
+    sorter->width = 1;
+    sorter->start = 0;
+    sorter->merging = 0;
+}
+
+int bms_sorter_step(bms_Sorter *sorter, size_t work)
+{
+    char *arr = sorter->arr;
+    char *tmp = sorter->tmp;
+    size_t item = sorter->item;
+    while (sorter->width < sorter->n)
     {
-        if (less(b, a))
+        if (!sorter->merging)
         {
-            memcpy(c, b, item);
-            b = (char *)b + item;
+            if (sorter->start + sorter->width >= sorter->n)
+            {
+                sorter->width *= 2;
+                sorter->start = 0;
+                continue;
+            }
+            sorter->mid = sorter->start + sorter->width;
+            sorter->end = sorter->n - sorter->mid > sorter->width ? sorter->mid + sorter->width : sorter->n;
+            if (!sorter->less(arr + item * sorter->mid, arr + item * (sorter->mid - 1)))
+            {
+                sorter->start = sorter->end;
+                continue;
+            }
+            sorter->a = sorter->start;
+            sorter->b = sorter->mid;
+            sorter->c = sorter->start;
+            sorter->merging = 1;
         }
-        else
+        while (work > 0 && sorter->a < sorter->mid && sorter->b < sorter->end)
         {
-            memcpy(c, a, item);
-            a = (char *)a + item;
+            if (sorter->less(arr + item * sorter->b, arr + item * sorter->a))
+                memcpy(tmp + item * sorter->c++, arr + item * sorter->b++, item);
+            else
+                memcpy(tmp + item * sorter->c++, arr + item * sorter->a++, item);
+            work--;
         }
-        c = (char *)c + item;
-    }
-    if (a < mid)
-    {
-        memcpy(c, a, mid - a);
+        if (sorter->a < sorter->mid && sorter->b < sorter->end)
+            return 0;
+        // What is left of the right run is already in place.
+        if (sorter->a < sorter->mid)
+            memcpy(tmp + item * sorter->c, arr + item * sorter->a, item * (sorter->mid - sorter->a));
+        memcpy(arr + item * sorter->start, tmp + item * sorter->start, item * (sorter->c + sorter->mid - sorter->a - sorter->start));
+        sorter->merging = 0;
+        sorter->start = sorter->end;
+        if (work == 0)
+            return sorter->width >= sorter->n;
     }
-    if (b < end)
-    {
-        memcpy(c, b, end - b);
-    }
-    memcpy(arr, tmp, item * (n1 + n2));
-    free(tmp);
+    return 1;
 }
 
-void sort(void *arr, size_t n, size_t item, bms_Less less)
+void bms_sort(void *arr, size_t n, size_t item, bms_Less less, const bms_Allocator *allocator)
 {
-    if (n > 1)
-    {
-        size_t n1 = n / 2;
-        size_t n2 = n - n1;
-        void *a1 = arr;
-        void *a2 = (char *)arr + item * n1;
-        sort(a1, n1, item, less);
-        sort(a2, n2, item, less);
-        merge(a1, n1, n2, item, less);
-    }
-}
\ No newline at end of file
+    bms_Sorter sorter;
+    char *tmp = n > 1 ? bms_allocate(allocator, NULL, 0, item * n) : NULL;
+    bms_sorter_open(&sorter, arr, n, item, less, tmp);
+    bms_sorter_step(&sorter, SIZE_MAX);
+    bms_release(allocator, tmp, item * n);
+}
@@ -1,10 +1,41 @@
 #ifndef __BMSPARSER_SORT_H__
 #define __BMSPARSER_SORT_H__
 
+#include <bmsparser.h>
 #include <stddef.h>
 
 typedef unsigned char (*bms_Less)(void *, void *);
 
-void sort(void *arr, size_t n, size_t item, bms_Less less);
+/*
+ * Resumable bottom-up merge sort.
+ * Merges runs of width 1, 2, 4, ... pair by pair, and can stop in the middle of a merge.
+ * tmp is scratch of n items owned by the caller, so a sorter can work in a buffer kept between sorts.
+ */
+typedef struct bms_Sorter
+{
+    char *arr;
+    size_t n;
+    size_t item;
+    bms_Less less;
+    char *tmp;
+    size_t width;
+    size_t start;
+    size_t mid;
+    size_t end;
+    size_t a;
+    size_t b;
+    size_t c;
+    unsigned char merging;
+} bms_Sorter;
 
-#endif
\ No newline at end of file
+void bms_sorter_open(bms_Sorter *sorter, void *arr, size_t n, size_t item, bms_Less less, void *tmp);
+
+/*
+ * Sort for about `work` items.
+ * Returns 1 once sorted.
+ */
+int bms_sorter_step(bms_Sorter *sorter, size_t work);
+
+void bms_sort(void *arr, size_t n, size_t item, bms_Less less, const bms_Allocator *allocator);
+
+#endif
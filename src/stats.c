@@ -0,0 +1,86 @@
+#include <bmsparser.h>
+#include <math.h>
+#include <string.h>
+#include "allocator.h"
+
+/*
+ * Whether an object is a note the player hits.
+ * The end of a paired long note belongs to its start.
+ */
+static int isPlayable(const bms_Obj *obj)
+{
+    return obj->type == bms_OBJTYPE_NOTE && !(obj->note.end && obj->note.pair >= 0);
+}
+
+/*
+ * A chart with a zero tempo times what follows it at infinity, or NaN, which has no second.
+ */
+static size_t secondOf(double time)
+{
+    return isfinite(time) && time > 0 ? (size_t)time : 0;
+}
+
+const bms_ChartStats *bms_compute_stats(bms_Chart *chart)
+{
+    bms_ChartStats *stats = &chart->stats;
+    const bms_Obj *objs = chart->objs;
+    size_t window = 0;
+    size_t i;
+    size_t j = 0;
+
+    if (chart->stats_valid)
+        return stats;
+
+    stats->notes = 0;
+    stats->longnotes = chart->longnotes_size;
+    stats->scratches = 0;
+    stats->length = 0;
+    stats->peak_nps = 0;
+    stats->peak_time = 0;
+    for (i = 0; i < chart->objs_size; i++)
+    {
+        if (!isPlayable(objs + i))
+            continue;
+        stats->notes++;
+        stats->scratches += objs[i].note.line == 6;
+        if (isfinite(objs[i].time) && objs[i].time > stats->length)
+            stats->length = objs[i].time;
+    }
+
+    stats->density_size = stats->notes ? secondOf(stats->length) + 1 : 0;
+    if (stats->density_size > stats->density_capacity)
+    {
+        stats->density = bms_allocate(&chart->allocator, stats->density, sizeof(size_t) * stats->density_capacity, sizeof(size_t) * stats->density_size);
+        stats->density_capacity = stats->density_size;
+    }
+    if (stats->density_size > 0)
+        memset(stats->density, 0, sizeof(size_t) * stats->density_size);
+
+    // Objects are in time order, so the notes within one second of note i are those in [i, j).
+    // Notes at a time that is not finite are left out; the window starts over after them.
+    for (i = 0; i < chart->objs_size; i++)
+    {
+        if (!isPlayable(objs + i) || !isfinite(objs[i].time))
+            continue;
+        stats->density[secondOf(objs[i].time)]++;
+        if (j <= i)
+        {
+            window = 1;
+            j = i + 1;
+        }
+        while (j < chart->objs_size && objs[j].time < objs[i].time + 1)
+        {
+            window += isPlayable(objs + j);
+            j++;
+        }
+        if (window > stats->peak_nps)
+        {
+            stats->peak_nps = window;
+            stats->peak_time = objs[i].time;
+        }
+        window--;
+    }
+
+    chart->stats_valid = 1;
+    return stats;
+}
@@ -1,7 +1,7 @@
 #ifndef __BMSPARSER_TABLE_H__
 #define __BMSPARSER_TABLE_H__
 
-const unsigned char shiftJIS_convTable[25088] = {
+static const unsigned char shiftJIS_convTable[25088] = {
 	0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00, 0x03, 
 	0x00, 0x04, 0x00, 0x05, 0x00, 0x06, 0x00, 0x07, 
 	0x00, 0x08, 0x00, 0x09, 0x00, 0x0a, 0x00, 0x0b, 
@@ -0,0 +1,775 @@
+#include <bmsparser/writer.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "sort.h"
+
+// Bytes staged between writes to a file.
+#define WRITER_CHUNK 65536
+
+// Most slots of a line; positions needing more are spread over more lines.
+#define SLOT_LIMIT 65536
+
+// Room for a number printed without exponent.
+#define NUMBER_SIZE 512
+
+static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/*
+ * Output of a write.
+ * With a file, data is a staging chunk flushed when full; otherwise it is the caller's buffer,
+ * and what does not fit is only counted.
+ */
+typedef struct Writer
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t total;
+    size_t written;
+    FILE *file;
+} Writer;
+
+/*
+ * One slot to write: an object or a sector.
+ * num / den is the position in the measure, with the smallest den that decodes back to fraction.
+ */
+typedef struct Event
+{
+    float fraction;
+    int measure;
+    int channel;
+    int key;
+    unsigned long num;
+    unsigned long den;
+    size_t row;
+} Event;
+
+/*
+ * One line of a channel in a measure.
+ * slots is the least common multiple of the simplest denominators of its events, low the largest of them.
+ */
+typedef struct Row
+{
+    unsigned long slots;
+    unsigned long low;
+    float last;
+} Row;
+
+/*
+ * Values of `#BPMxx` or `#STOPxx` in ascending order, key i + 1 holding values[i].
+ */
+typedef struct Definitions
+{
+    double values[1295];
+    int size;
+} Definitions;
+
+/*
+ * An event on channel 08 or 09 waiting for the key of its value.
+ */
+typedef struct Pending
+{
+    double value;
+    size_t event;
+} Pending;
+
+typedef struct Plan
+{
+    const bms_Chart *chart;
+    Event *events;
+    size_t events_size;
+    size_t events_capacity;
+    Definitions bpms;
+    Definitions stops;
+    unsigned char lnobj[1296 / 8 + 1];
+    Row *rows;
+    size_t rows_capacity;
+    char *line;
+    size_t line_capacity;
+} Plan;
+
+static void flush(Writer *writer)
+{
+    if (writer->file && writer->size)
+    {
+        writer->written += fwrite(writer->data, 1, writer->size, writer->file);
+        writer->size = 0;
+    }
+}
+
+static void put(Writer *writer, const char *data, size_t size)
+{
+    writer->total += size;
+    while (size > 0)
+    {
+        if (writer->size == writer->capacity)
+        {
+            if (!writer->file)
+                return;
+            flush(writer);
+        }
+        size_t n = writer->capacity - writer->size < size ? writer->capacity - writer->size : size;
+        memcpy(writer->data + writer->size, data, n);
+        writer->size += n;
+        data += n;
+        size -= n;
+    }
+}
+
+static void putLine(Writer *writer, const char *name, const char *text, size_t length)
+{
+    put(writer, name, strlen(name));
+    put(writer, text, length);
+    put(writer, "\n", 1);
+}
+
+static void putText(Writer *writer, const char *name, const char *text)
+{
+    if (text)
+        putLine(writer, name, text, strlen(text));
+}
+
+/*
+ * Shortest fixed-point text of value * scale that reads back as value, since the parser takes no negative exponent.
+ * single compares as a float, for values stored in one.
+ */
+static int formatNumber(char *buffer, double value, double scale, int single)
+{
+    int length = 0;
+    int decimals;
+    for (decimals = 0; decimals <= 40; decimals++)
+    {
+        length = snprintf(buffer, NUMBER_SIZE, "%.*f", decimals, value * scale);
+        double read = atof(buffer) / scale;
+        if (single ? (float)read == (float)value : read == value)
+            break;
+    }
+    return length;
+}
+
+static void putNumber(Writer *writer, const char *name, double value, double scale, int single)
+{
+    char buffer[NUMBER_SIZE];
+    int length = formatNumber(buffer, value, scale, single);
+    putLine(writer, name, buffer, length);
+}
+
+// Nearest integer of a value that is not negative, without libm; doubles from 2^52 up are integers already.
+static double roundNearest(double value)
+{
+    return value < 4503599627370496.0 ? (double)(long long)(value + 0.5) : value;
+}
+
+static void keyText(char *text, int key, int base)
+{
+    text[0] = digits[key / base];
+    text[1] = digits[key % base];
+}
+
+static unsigned char pendingLess(void *a, void *b)
+{
+    return ((Pending *)a)->value < ((Pending *)b)->value;
+}
+
+/*
+ * Key of the defined value nearest to value.
+ */
+static int nearestKey(const Definitions *definitions, double value)
+{
+    int low = 0;
+    int high = definitions->size;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (definitions->values[mid] < value)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == definitions->size || low > 0 && value - definitions->values[low - 1] < definitions->values[low] - value)
+        low--;
+    return low + 1;
+}
+
+/*
+ * Define the values of the pending events, sorted and deduplicated once, and key the events.
+ * Past 1295 values, keys go to values spread evenly over the sorted ones, and events use the nearest.
+ */
+static void defineKeys(Plan *plan, Definitions *definitions, Pending *pending, size_t size)
+{
+    size_t distinct = 0;
+    size_t defined = 0;
+    size_t i, k;
+    bms_sort(pending, size, sizeof(Pending), pendingLess, &plan->chart->allocator);
+    for (i = 0; i < size; i++)
+    {
+        distinct += i == 0 || pending[i].value != pending[i - 1].value;
+    }
+    definitions->size = distinct < 1295 ? (int)distinct : 1295;
+    for (i = 0, k = 0; i < size; i++)
+    {
+        if (i > 0 && pending[i].value == pending[i - 1].value)
+            continue;
+        if (defined < (size_t)definitions->size && k == defined * distinct / definitions->size)
+            definitions->values[defined++] = pending[i].value;
+        k++;
+    }
+    for (i = 0; i < size; i++)
+    {
+        plan->events[pending[i].event].key = nearestKey(definitions, pending[i].value);
+    }
+}
+
+/*
+ * Channel an object is written on, -1 if none decodes to it.
+ * Paired long notes go on 5x and 6x, whose slots toggle between start and end.
+ */
+static int channelOf(const bms_Obj *obj)
+{
+    if (obj->type == bms_OBJTYPE_BGM)
+        return 1;
+    if (obj->type == bms_OBJTYPE_BMP)
+        return obj->bmp.layer < 0 ? 6 : obj->bmp.layer > 0 ? 7 : 4;
+    if (obj->misc.player < 1 || obj->misc.player > 2 || obj->misc.line < 1 || obj->misc.line > 9)
+        return -1;
+    switch (obj->type)
+    {
+    case bms_OBJTYPE_NOTE:
+        return ((obj->note.pair >= 0 ? 5 : 1) + obj->note.player - 1) * 36 + obj->note.line;
+    case bms_OBJTYPE_INVISIBLE:
+        return (3 + obj->misc.player - 1) * 36 + obj->misc.line;
+    case bms_OBJTYPE_BOMB:
+        return (13 + obj->misc.player - 1) * 36 + obj->misc.line;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Length of the stop ending at a non-inclusive sector, in 1/192 measures.
+ */
+static double stopLength(const bms_Chart *chart, size_t i)
+{
+    double length = chart->sectors[i].stop * 192;
+    return length > 0 ? roundNearest(length) : 0;
+}
+
+/*
+ * Whether every tempo change fits channel 03, a hexadecimal BPM of 1 ~ 255.
+ * They all go on one channel, so changes at the same position keep their order.
+ */
+static int hexTempo(const bms_Chart *chart)
+{
+    size_t i;
+    for (i = 1; i < chart->sectors_size; i++)
+    {
+        const bms_Sector *sector = chart->sectors + i;
+        double bpm = roundNearest(sector->delta * 240);
+        if (sector->inclusive && sector->delta > 0 && (bpm < 1 || bpm > 255 || (int)bpm / 240.0 != sector->delta))
+            return 0;
+    }
+    return 1;
+}
+
+static Event *pushEvent(Plan *plan, float fraction, int channel, int key)
+{
+    Event *event = plan->events + plan->events_size++;
+    event->fraction = fraction;
+    event->measure = (int)fraction;
+    event->channel = channel;
+    event->key = key;
+    return event;
+}
+
+static int writable(float fraction)
+{
+    return fraction >= 0 && fraction < 1000;
+}
+
+static unsigned char eventLess(void *a, void *b)
+{
+    Event *n = (Event *)a;
+    Event *m = (Event *)b;
+    return n->measure < m->measure || n->measure == m->measure && n->channel < m->channel;
+}
+
+static void openPlan(Plan *plan, const bms_Chart *chart)
+{
+    int hex = hexTempo(chart);
+    Pending *bpms = bms_allocate(&chart->allocator, NULL, 0, sizeof(Pending) * chart->sectors_size);
+    Pending *stops = bms_allocate(&chart->allocator, NULL, 0, sizeof(Pending) * chart->sectors_size);
+    size_t bpms_size = 0;
+    size_t stops_size = 0;
+    size_t i, j, k;
+
+    plan->chart = chart;
+    plan->events_capacity = chart->objs_size + chart->sectors_size + 1;
+    plan->events = bms_allocate(&chart->allocator, NULL, 0, sizeof(Event) * plan->events_capacity);
+    plan->events_size = 0;
+    plan->bpms.size = 0;
+    plan->stops.size = 0;
+    memset(plan->lnobj, 0, sizeof(plan->lnobj));
+    plan->rows = NULL;
+    plan->rows_capacity = 0;
+    plan->line = NULL;
+    plan->line_capacity = 0;
+
+    for (i = 0; i < chart->objs_size; i++)
+    {
+        const bms_Obj *obj = chart->objs + i;
+        int channel = channelOf(obj);
+        int key = obj->type == bms_OBJTYPE_BGM ? obj->bgm.key : obj->type == bms_OBJTYPE_BMP ? obj->bmp.key : obj->misc.key;
+        if (channel < 0 || key < 1 || key > 1295 || !writable(obj->fraction))
+            continue;
+        // An unpaired end can only come from a note channel, as a #LNOBJ key.
+        if (obj->type == bms_OBJTYPE_NOTE && obj->note.end && obj->note.pair < 0)
+            plan->lnobj[key >> 3] |= 1 << (key & 7);
+        pushEvent(plan, obj->fraction, channel, key);
+    }
+
+    // A stop is an inclusive sector of delta 0 followed by a non-inclusive one at the same fraction;
+    // inclusive sectors of delta 0 left over are tempo changes to 0.
+    for (i = 1; i < chart->sectors_size; i = j)
+    {
+        size_t pairs = 0;
+        for (j = i; j < chart->sectors_size && chart->sectors[j].fraction == chart->sectors[i].fraction; j++)
+        {
+            pairs += !chart->sectors[j].inclusive;
+        }
+        if (!writable(chart->sectors[i].fraction))
+            continue;
+        for (k = i; k < j; k++)
+        {
+            const bms_Sector *sector = chart->sectors + k;
+            if (!sector->inclusive)
+            {
+                stops[stops_size].value = stopLength(chart, k);
+                stops[stops_size++].event = plan->events_size;
+                pushEvent(plan, sector->fraction, 9, 0);
+            }
+            else if (sector->delta == 0 && pairs > 0)
+                pairs--;
+            else if (hex && sector->delta > 0)
+                pushEvent(plan, sector->fraction, 3, (int)roundNearest(sector->delta * 240));
+            else
+            {
+                bpms[bpms_size].value = sector->delta;
+                bpms[bpms_size++].event = plan->events_size;
+                pushEvent(plan, sector->fraction, 8, 0);
+            }
+        }
+    }
+    defineKeys(plan, &plan->bpms, bpms, bpms_size);
+    defineKeys(plan, &plan->stops, stops, stops_size);
+    bms_release(&chart->allocator, bpms, sizeof(Pending) * chart->sectors_size);
+    bms_release(&chart->allocator, stops, sizeof(Pending) * chart->sectors_size);
+
+    bms_sort(plan->events, plan->events_size, sizeof(Event), eventLess, &chart->allocator);
+}
+
+static void closePlan(Plan *plan)
+{
+    const bms_Allocator *allocator = &plan->chart->allocator;
+    bms_release(allocator, plan->events, sizeof(Event) * plan->events_capacity);
+    bms_release(allocator, plan->rows, sizeof(Row) * plan->rows_capacity);
+    bms_release(allocator, plan->line, sizeof(char) * plan->line_capacity);
+}
+
+/*
+ * Compare the fraction slot n / d of a measure decodes to with the target, as decodeChannel computes it.
+ */
+static int slotOrder(int measure, unsigned long n, unsigned long d, float fraction)
+{
+    float decoded = measure + (float)n / d;
+    return decoded < fraction ? -1 : decoded > fraction;
+}
+
+/*
+ * Largest t such that (n + t * sn) / (d + t * sd) stays on the given side of the target, knowing t = 1 does.
+ */
+static unsigned long gallop(const Event *event, unsigned long n, unsigned long d, unsigned long sn, unsigned long sd, int side)
+{
+    unsigned long good = 1;
+    unsigned long bad = 2;
+    while (d + bad * sd <= SLOT_LIMIT && slotOrder(event->measure, n + bad * sn, d + bad * sd, event->fraction) == side)
+    {
+        good = bad;
+        bad *= 2;
+    }
+    while (bad - good > 1)
+    {
+        unsigned long mid = good + (bad - good) / 2;
+        if (d + mid * sd <= SLOT_LIMIT && slotOrder(event->measure, n + mid * sn, d + mid * sd, event->fraction) == side)
+            good = mid;
+        else
+            bad = mid;
+    }
+    return good;
+}
+
+/*
+ * Find the slot with the smallest denominator decoding to the fraction of the event.
+ * Slots decoding to it form an interval, so the first mediant of the Stern-Brocot descent inside it is the simplest;
+ * runs in the same direction are galloped, so it takes time logarithmic in the denominator.
+ */
+static void slotOf(Event *event)
+{
+    unsigned long ln = 0, ld = 1, hn = 1, hd = 1;
+    event->num = 0;
+    event->den = 1;
+    if (!slotOrder(event->measure, 0, 1, event->fraction))
+        return;
+    while (ld + hd <= SLOT_LIMIT)
+    {
+        int order = slotOrder(event->measure, ln + hn, ld + hd, event->fraction);
+        unsigned long t;
+        if (!order)
+        {
+            event->num = ln + hn;
+            event->den = ld + hd;
+            return;
+        }
+        if (order < 0)
+        {
+            t = gallop(event, ln, ld, hn, hd, -1);
+            ln += t * hn;
+            ld += t * hd;
+        }
+        else
+        {
+            t = gallop(event, hn, hd, ln, ld, 1);
+            hn += t * ln;
+            hd += t * ld;
+        }
+    }
+    // No slot decodes to it, e.g. an edited fraction: take the nearest one below.
+    event->num = ln;
+    event->den = ld;
+}
+
+static unsigned long gcd(unsigned long a, unsigned long b)
+{
+    while (b)
+    {
+        unsigned long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Least common multiple, or more than SLOT_LIMIT.
+static unsigned long lcm(unsigned long a, unsigned long b)
+{
+    a /= gcd(a, b);
+    return a > SLOT_LIMIT / b ? SLOT_LIMIT + 1 : a * b;
+}
+
+/*
+ * Slot out of `slots` that decodes to the fraction of the event, if any.
+ */
+static int slotIn(const Event *event, unsigned long slots, unsigned long *num)
+{
+    long nearest = (long)roundNearest(((double)event->fraction - event->measure) * slots);
+    long n;
+    for (n = nearest - 1; n <= nearest + 1; n++)
+    {
+        if (n >= 0 && (unsigned long)n < slots && !slotOrder(event->measure, n, slots, event->fraction))
+        {
+            *num = n;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Give a row the fewest slots placing all of its events.
+ * No fewer than the largest denominator can, and their least common multiple always does,
+ * but far measures leave floats too coarse for the simplest slots to agree, so the range between is scanned.
+ * The event that failed last is tried first, as it tends to fail again.
+ */
+static int resolveRow(Event *events, size_t size, Row *row)
+{
+    unsigned long slots;
+    unsigned long num;
+    size_t failed = 0;
+    size_t i;
+    for (slots = row->low; slots <= row->slots && slots <= SLOT_LIMIT; slots++)
+    {
+        if (!slotIn(events + failed, slots, &num))
+            continue;
+        for (i = 0; i < size && slotIn(events + i, slots, &num); i++)
+            ;
+        if (i == size)
+            break;
+        failed = i;
+    }
+    if (slots > row->slots || slots > SLOT_LIMIT)
+        return 0;
+    row->slots = slots;
+    for (i = 0; i < size; i++)
+    {
+        slotIn(events + i, slots, &events[i].num);
+        events[i].den = slots;
+    }
+    return 1;
+}
+
+static Row *pushRow(Plan *plan, size_t rows)
+{
+    if (rows == plan->rows_capacity)
+    {
+        size_t capacity = plan->rows_capacity ? plan->rows_capacity * 2 : 4;
+        plan->rows = bms_allocate(&plan->chart->allocator, plan->rows, sizeof(Row) * plan->rows_capacity, sizeof(Row) * capacity);
+        plan->rows_capacity = capacity;
+    }
+    return plan->rows + rows;
+}
+
+static unsigned char fractionLess(void *a, void *b)
+{
+    return ((Event *)a)->fraction < ((Event *)b)->fraction;
+}
+
+static unsigned char rowLess(void *a, void *b)
+{
+    return ((Event *)a)->row < ((Event *)b)->row;
+}
+
+/*
+ * Spread the events of a group over rows, in fraction order, then group them by row.
+ * The n-th event at a fraction goes on row n, so events at the same fraction keep their order.
+ * With `ordered`, rows are consecutive runs of the events instead, so reading the rows one after another
+ * gives the events in their order; long note channels toggle between start and end in that order.
+ * With `spill`, an event goes on the first row it fits without taking it past SLOT_LIMIT slots,
+ * placed by its simplest slot; otherwise each row is resolved afterwards.
+ */
+static size_t assignRows(Plan *plan, Event *events, size_t size, int ordered, int spill)
+{
+    size_t rows = 0;
+    size_t run = 0;
+    size_t i, r;
+    for (i = 0; i < size; i++)
+    {
+        Event *event = events + i;
+        run = i > 0 && events[i - 1].fraction == event->fraction ? run + 1 : 0;
+        // Only the last row can take it when ordered.
+        size_t first = ordered ? (rows ? rows - 1 : 0) : spill ? 0 : run;
+        // Mostly the row already has a slot for it.
+        if (!spill && first < rows && plan->rows[first].last != event->fraction && slotIn(event, plan->rows[first].slots, &event->num))
+        {
+            event->den = plan->rows[first].slots;
+            plan->rows[first].last = event->fraction;
+            event->row = first;
+            continue;
+        }
+        slotOf(event);
+        for (r = first; r < rows; r++)
+        {
+            Row *row = plan->rows + r;
+            unsigned long slots = lcm(row->slots, event->den);
+            if (row->last != event->fraction && (!spill || slots <= SLOT_LIMIT))
+            {
+                row->slots = slots;
+                row->low = row->low > event->den ? row->low : event->den;
+                break;
+            }
+        }
+        if (r == rows)
+        {
+            Row *row = pushRow(plan, rows++);
+            row->slots = event->den;
+            row->low = event->den;
+        }
+        plan->rows[r].last = event->fraction;
+        event->row = r;
+    }
+    if (rows > 1)
+        bms_sort(events, size, sizeof(Event), rowLess, &plan->chart->allocator);
+    return rows;
+}
+
+/*
+ * Write the events of one channel in one measure, in fraction order, on as few lines of as few slots as possible.
+ */
+static void writeGroup(Writer *writer, Plan *plan, Event *events, size_t size)
+{
+    int ordered = events->channel / 36 == 5 || events->channel / 36 == 6;
+    size_t rows = assignRows(plan, events, size, ordered, 0);
+    size_t i, j, r;
+
+    for (r = 0, i = 0; r < rows; r++, i = j)
+    {
+        for (j = i; j < size && events[j].row == r; j++)
+            ;
+        if (!resolveRow(events + i, j - i, plan->rows + r))
+            break;
+    }
+    if (r < rows)
+    {
+        bms_sort(events, size, sizeof(Event), fractionLess, &plan->chart->allocator);
+        rows = assignRows(plan, events, size, ordered, 1);
+    }
+
+    for (r = 0, i = 0; r < rows; r++)
+    {
+        unsigned long slots = plan->rows[r].slots;
+        size_t length = 7 + 2 * slots + 1;
+        if (length > plan->line_capacity)
+        {
+            plan->line = bms_allocate(&plan->chart->allocator, plan->line, sizeof(char) * plan->line_capacity, sizeof(char) * length * 2);
+            plan->line_capacity = length * 2;
+        }
+        char *line = plan->line;
+        line[0] = '#';
+        line[1] = digits[events->measure / 100];
+        line[2] = digits[events->measure / 10 % 10];
+        line[3] = digits[events->measure % 10];
+        keyText(line + 4, events->channel, 36);
+        line[6] = ':';
+        memset(line + 7, '0', 2 * slots);
+        line[length - 1] = '\n';
+        for (; i < size && events[i].row == r; i++)
+        {
+            keyText(line + 7 + 2 * (events[i].num * (slots / events[i].den)), events[i].key, events->channel == 3 ? 16 : 36);
+        }
+        put(writer, line, length);
+    }
+}
+
+static void writeHeaders(Writer *writer, const Plan *plan)
+{
+    const bms_Chart *chart = plan->chart;
+    char name[8];
+    char number[NUMBER_SIZE];
+    int i;
+
+    putText(writer, "#GENRE ", chart->genre);
+    // Lines lose trailing blanks, which a title split from its subtitle keeps, so they are joined back when they can be.
+    if (chart->title && chart->subtitle && !strchr(chart->subtitle, '['))
+    {
+        put(writer, "#TITLE ", 7);
+        put(writer, chart->title, strlen(chart->title));
+        put(writer, "[", 1);
+        put(writer, chart->subtitle, strlen(chart->subtitle));
+        put(writer, "]\n", 2);
+    }
+    else
+    {
+        putText(writer, "#TITLE ", chart->title);
+        putText(writer, "#SUBTITLE ", chart->subtitle);
+    }
+    putText(writer, "#ARTIST ", chart->artist);
+    putText(writer, "#SUBARTIST ", chart->subartist);
+    putText(writer, "#STAGEFILE ", chart->stagefile);
+    putText(writer, "#BANNER ", chart->banner);
+    if (chart->playlevel >= 0)
+        putLine(writer, "#PLAYLEVEL ", number, snprintf(number, sizeof(number), "%d", chart->playlevel));
+    if (chart->difficulty >= bms_DIFFICULTY_BEGINNER && chart->difficulty <= bms_DIFFICULTY_INSANE)
+        putLine(writer, "#DIFFICULTY ", number, snprintf(number, sizeof(number), "%d", chart->difficulty));
+    if (chart->rank >= bms_RANK_VERYHARD && chart->rank <= bms_RANK_EASY)
+        putLine(writer, "#RANK ", number, snprintf(number, sizeof(number), "%d", chart->rank));
+    putNumber(writer, "#TOTAL ", chart->total, 1, 1);
+    putNumber(writer, "#BPM ", chart->sectors[0].delta, 240, 0);
+
+    for (i = 1; i < 1296; i++)
+    {
+        if (plan->lnobj[i >> 3] >> (i & 7) & 1)
+        {
+            keyText(number, i, 36);
+            putLine(writer, "#LNOBJ ", number, 2);
+        }
+    }
+    for (i = 0; i < 1296; i++)
+    {
+        if (chart->wavs[i])
+        {
+            memcpy(name, "#WAV", 4);
+            keyText(name + 4, i, 36);
+            memcpy(name + 6, " ", 2);
+            putText(writer, name, chart->wavs[i]);
+        }
+    }
+    for (i = 0; i < 1296; i++)
+    {
+        if (chart->bmps[i])
+        {
+            memcpy(name, "#BMP", 4);
+            keyText(name + 4, i, 36);
+            memcpy(name + 6, " ", 2);
+            putText(writer, name, chart->bmps[i]);
+        }
+    }
+    for (i = 0; i < plan->bpms.size; i++)
+    {
+        memcpy(name, "#BPM", 4);
+        keyText(name + 4, i + 1, 36);
+        memcpy(name + 6, " ", 2);
+        putNumber(writer, name, plan->bpms.values[i], 240, 0);
+    }
+    for (i = 0; i < plan->stops.size; i++)
+    {
+        char stop[9] = "#STOP";
+        keyText(stop + 5, i + 1, 36);
+        memcpy(stop + 7, " ", 2);
+        putNumber(writer, stop, plan->stops.values[i], 1, 0);
+    }
+    put(writer, "\n", 1);
+}
+
+static void writeChart(Writer *writer, const bms_Chart *chart)
+{
+    Plan plan;
+    char line[16 + NUMBER_SIZE];
+    size_t i = 0;
+    size_t j;
+    int measure;
+
+    openPlan(&plan, chart);
+    writeHeaders(writer, &plan);
+    for (measure = 0; measure < 1000; measure++)
+    {
+        if (chart->signatures[measure] != 1.0f)
+        {
+            snprintf(line, sizeof(line), "#%03d02:", measure);
+            putNumber(writer, line, chart->signatures[measure], 1, 1);
+        }
+        for (; i < plan.events_size && plan.events[i].measure == measure; i = j)
+        {
+            for (j = i; j < plan.events_size && plan.events[j].measure == measure && plan.events[j].channel == plan.events[i].channel; j++)
+                ;
+            writeGroup(writer, &plan, plan.events + i, j - i);
+        }
+    }
+    closePlan(&plan);
+}
+
+size_t bms_write(const bms_Chart *chart, FILE *file)
+{
+    Writer writer;
+    writer.capacity = WRITER_CHUNK;
+    writer.data = bms_allocate(&chart->allocator, NULL, 0, sizeof(char) * writer.capacity);
+    writer.size = 0;
+    writer.total = 0;
+    writer.written = 0;
+    writer.file = file;
+    writeChart(&writer, chart);
+    flush(&writer);
+    bms_release(&chart->allocator, writer.data, sizeof(char) * writer.capacity);
+    return writer.written;
+}
+
+size_t bms_write_buffer(const bms_Chart *chart, char *data, size_t capacity)
+{
+    Writer writer;
+    writer.data = data;
+    writer.capacity = capacity;
+    writer.size = 0;
+    writer.total = 0;
+    writer.written = 0;
+    writer.file = NULL;
+    writeChart(&writer, chart);
+    return writer.total;
+}